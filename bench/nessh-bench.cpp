@@ -0,0 +1,128 @@
+// nessh-bench - runs contending hosts against BandwidthScheduler and prints the aggregate rate
+// every second, then what each host got in total
+//
+// Usage: nessh-bench [hosts] [megabytes per second] [seconds] [milliseconds per write]
+//
+// Half of the hosts send 16 KiB requests like the SCP/SFTP loops, the other half 64 KiB like
+// commandInput, and one interactive host sends small commands to show their wait. Each host spends
+// the given time writing what it was granted before asking again, like a session on a slow link
+
+#include "BandwidthScheduler.h"
+
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+
+using namespace std;
+
+static const size_t SMALL_REQUEST = 16384;
+static const size_t LARGE_REQUEST = 65536;
+static const size_t COMMAND_REQUEST = 256;
+
+int main(int argc, char** argv) {
+	size_t hosts = argc > 1 ? strtoul(argv[1], NULL, 10) : 20;
+	double rate = argc > 2 ? strtod(argv[2], NULL) : 50;
+	int seconds = argc > 3 ? atoi(argv[3]) : 10;
+	double write_time = argc > 4 ? strtod(argv[4], NULL) : 0;
+
+	if (hosts == 0 || rate <= 0 || seconds <= 0 || write_time < 0) {
+		cout << "Usage: " << argv[0] << " [hosts] [megabytes per second] [seconds] [milliseconds per write]\n";
+
+		return 1;
+	}
+
+	BandwidthScheduler scheduler;
+	scheduler.setRate(rate * 1000 * 1000);
+
+	atomic<bool> running(true);
+	unique_ptr<atomic<size_t>[]> sent(new atomic<size_t>[hosts]);
+	vector<thread> threads;
+
+	for (size_t i = 0; i < hosts; i++) {
+		sent[i] = 0;
+
+		threads.push_back(thread([&scheduler, &running, &sent, i, write_time] {
+			size_t bytes = i % 2 == 0 ? SMALL_REQUEST : LARGE_REQUEST;
+			string host = "host" + to_string(i);
+
+			while (running) {
+				scheduler.acquire(host, bytes, PRIORITY_BULK);
+				sent[i] += bytes;
+
+				if (write_time > 0)
+					this_thread::sleep_for(chrono::duration<double, milli>(write_time));
+			}
+		}));
+	}
+
+	double worst_wait = 0;
+
+	thread interactive([&scheduler, &running, &worst_wait] {
+		while (running) {
+			auto start = chrono::steady_clock::now();
+			scheduler.acquire("interactive", COMMAND_REQUEST, PRIORITY_INTERACTIVE);
+			worst_wait = max(worst_wait, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+
+			this_thread::sleep_for(chrono::milliseconds(20));
+		}
+	});
+
+	cout << fixed << setprecision(2);
+
+	// What the hosts would send without any limit, the aggregate should get close to this when it's lower
+	if (write_time > 0) {
+		double unlimited = 0;
+
+		for (size_t i = 0; i < hosts; i++)
+			unlimited += (i % 2 == 0 ? SMALL_REQUEST : LARGE_REQUEST) / (write_time / 1000);
+
+		cout << "unlimited: " << unlimited / 1e6 << " MB/s\n";
+	}
+
+	size_t previous = 0;
+
+	for (int second = 1; second <= seconds; second++) {
+		this_thread::sleep_for(chrono::seconds(1));
+		size_t total = 0;
+
+		for (size_t i = 0; i < hosts; i++)
+			total += sent[i];
+
+		cout << "second " << second << ": " << (total - previous) / 1e6 << " MB/s\n";
+		previous = total;
+	}
+
+	// Lifting the limit lets every waiting host through so the threads can finish
+	running = false;
+	scheduler.setRate(0);
+
+	for (auto& thread : threads)
+		thread.join();
+
+	interactive.join();
+
+	size_t minimum[2] = { SIZE_MAX, SIZE_MAX };
+	size_t maximum[2] = { 0, 0 };
+
+	for (size_t i = 0; i < hosts; i++) {
+		cout << "host" << i << " (" << (i % 2 == 0 ? SMALL_REQUEST : LARGE_REQUEST) / 1024 << " KiB requests): " << sent[i] / 1e6 << " MB\n";
+
+		minimum[i % 2] = min(minimum[i % 2], sent[i].load());
+		maximum[i % 2] = max(maximum[i % 2], sent[i].load());
+	}
+
+	cout << "16 KiB hosts: " << minimum[0] / 1e6 << " - " << maximum[0] / 1e6 << " MB\n";
+
+	if (hosts > 1)
+		cout << "64 KiB hosts: " << minimum[1] / 1e6 << " - " << maximum[1] / 1e6 << " MB\n";
+
+	cout << "worst interactive wait: " << worst_wait * 1000 << " ms\n";
+
+	return 0;
+}
@@ -0,0 +1,309 @@
+// nessh-helper - deployed to remote hosts and started on a single channel, answers batched
+// requests from libnessh on stdin/stdout (see HelperProtocol.h)
+
+#include "HelperProtocol.h"
+#include "Cksum.h"
+
+#include <string>
+#include <cstdio>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+using namespace std;
+
+static bool readExact(int fd, char* buffer, size_t length) {
+	while (length > 0) {
+		ssize_t amount = read(fd, buffer, length);
+		
+		if (amount < 0 && errno == EINTR)
+			continue;
+		
+		if (amount <= 0)
+			return false;
+		
+		buffer += amount;
+		length -= amount;
+	}
+	
+	return true;
+}
+
+static bool writeExact(int fd, const char* buffer, size_t length) {
+	while (length > 0) {
+		ssize_t amount = write(fd, buffer, length);
+		
+		if (amount < 0 && errno == EINTR)
+			continue;
+		
+		if (amount <= 0)
+			return false;
+		
+		buffer += amount;
+		length -= amount;
+	}
+	
+	return true;
+}
+
+static bool readFrame(string& payload) {
+	char header[4];
+	
+	if (!readExact(STDIN_FILENO, header, sizeof(header)))
+		return false;
+	
+	string header_string(header, sizeof(header));
+	HelperReader reader(header_string);
+	uint32_t length;
+	reader.getU32(length);
+	
+	if (length > HELPER_MAX_FRAME)
+		return false;
+	
+	payload.resize(length);
+	
+	return length == 0 || readExact(STDIN_FILENO, &payload.at(0), length);
+}
+
+static void statFiles(HelperReader& reader, HelperWriter& reply) {
+	uint32_t count;
+	
+	if (!reader.getU32(count)) {
+		reply.putU8(HELPER_STATUS_MALFORMED);
+		
+		return;
+	}
+	
+	HelperWriter entries;
+	
+	for (uint32_t i = 0; i < count; i++) {
+		string path;
+		
+		if (!reader.getString(path)) {
+			reply.putU8(HELPER_STATUS_MALFORMED);
+			
+			return;
+		}
+		
+		struct stat information;
+		bool exists = stat(path.c_str(), &information) == 0;
+		
+		entries.putU8(exists);
+		entries.putU32(exists ? information.st_mode : 0);
+		entries.putU64(exists ? information.st_size : 0);
+		entries.putU64(exists ? information.st_mtime : 0);
+	}
+	
+	reply.putU8(HELPER_STATUS_OK);
+	reply.putRaw(entries);
+}
+
+static bool hashFile(const string& path, uint32_t& crc, uint64_t& size) {
+	int fd = open(path.c_str(), O_RDONLY);
+	
+	if (fd < 0)
+		return false;
+	
+	const size_t FILE_BUFFER_SIZE = 65536;
+	static char file_buffer[FILE_BUFFER_SIZE];
+	
+	crc = 0;
+	size = 0;
+	
+	while (true) {
+		ssize_t amount = read(fd, file_buffer, FILE_BUFFER_SIZE);
+		
+		if (amount < 0 && errno == EINTR)
+			continue;
+		
+		if (amount < 0) {
+			close(fd);
+			
+			return false;
+		}
+		
+		if (amount == 0)
+			break;
+		
+		crc = cksumUpdate(crc, file_buffer, amount);
+		size += amount;
+	}
+	
+	close(fd);
+	return true;
+}
+
+static void hashFiles(HelperReader& reader, HelperWriter& reply) {
+	uint32_t count;
+	
+	if (!reader.getU32(count)) {
+		reply.putU8(HELPER_STATUS_MALFORMED);
+		
+		return;
+	}
+	
+	HelperWriter entries;
+	
+	for (uint32_t i = 0; i < count; i++) {
+		string path;
+		
+		if (!reader.getString(path)) {
+			reply.putU8(HELPER_STATUS_MALFORMED);
+			
+			return;
+		}
+		
+		uint32_t crc = 0;
+		uint64_t size = 0;
+		bool ok = hashFile(path, crc, size);
+		
+		entries.putU8(ok);
+		entries.putU32(crc);
+		entries.putU64(size);
+	}
+	
+	reply.putU8(HELPER_STATUS_OK);
+	reply.putRaw(entries);
+}
+
+static void execCommand(HelperReader& reader, HelperWriter& reply) {
+	string command;
+	
+	if (!reader.getString(command)) {
+		reply.putU8(HELPER_STATUS_MALFORMED);
+		
+		return;
+	}
+	
+	// Keep the command away from our stdin, it carries the protocol
+	FILE* pipe = popen(("{\n" + command + "\n} < /dev/null 2>&1").c_str(), "r");
+	
+	if (pipe == NULL) {
+		reply.putU8(HELPER_STATUS_ERROR);
+		
+		return;
+	}
+	
+	string output;
+	char buffer[4096];
+	size_t amount;
+	
+	while ((amount = fread(buffer, 1, sizeof(buffer), pipe)) > 0)
+		output.append(buffer, amount);
+	
+	int status = pclose(pipe);
+	
+	reply.putU8(HELPER_STATUS_OK);
+	reply.putU32(WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+	reply.putString(output);
+}
+
+static void readRange(HelperReader& reader, HelperWriter& reply) {
+	string path;
+	uint64_t offset;
+	uint32_t length;
+	
+	if (!reader.getString(path) || !reader.getU64(offset) || !reader.getU32(length) || length > HELPER_MAX_FRAME / 2) {
+		reply.putU8(HELPER_STATUS_MALFORMED);
+		
+		return;
+	}
+	
+	int fd = open(path.c_str(), O_RDONLY);
+	
+	if (fd < 0) {
+		reply.putU8(HELPER_STATUS_ERROR);
+		
+		return;
+	}
+	
+	string data(length, '\0');
+	size_t total = 0;
+	
+	while (total < length) {
+		ssize_t amount = pread(fd, &data.at(total), length - total, offset + total);
+		
+		if (amount < 0 && errno == EINTR)
+			continue;
+		
+		if (amount <= 0)
+			break;
+		
+		total += amount;
+	}
+	
+	close(fd);
+	data.resize(total);
+	
+	reply.putU8(HELPER_STATUS_OK);
+	reply.putString(data);
+}
+
+static void writeRange(HelperReader& reader, HelperWriter& reply) {
+	string path;
+	uint64_t offset;
+	string data;
+	
+	if (!reader.getString(path) || !reader.getU64(offset) || !reader.getString(data)) {
+		reply.putU8(HELPER_STATUS_MALFORMED);
+		
+		return;
+	}
+	
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
+	
+	if (fd < 0) {
+		reply.putU8(HELPER_STATUS_ERROR);
+		
+		return;
+	}
+	
+	size_t total = 0;
+	
+	while (total < data.length()) {
+		ssize_t amount = pwrite(fd, data.c_str() + total, data.length() - total, offset + total);
+		
+		if (amount < 0 && errno == EINTR)
+			continue;
+		
+		if (amount <= 0)
+			break;
+		
+		total += amount;
+	}
+	
+	close(fd);
+	reply.putU8(total == data.length() ? HELPER_STATUS_OK : HELPER_STATUS_ERROR);
+}
+
+int main() {
+	string payload;
+	
+	while (readFrame(payload)) {
+		HelperReader reader(payload);
+		HelperWriter reply;
+		uint8_t opcode;
+		
+		if (!reader.getU8(opcode) || opcode == HELPER_QUIT)
+			break;
+		
+		switch (opcode) {
+			case HELPER_STAT:	statFiles(reader, reply); break;
+			case HELPER_HASH:	hashFiles(reader, reply); break;
+			case HELPER_EXEC:	execCommand(reader, reply); break;
+			case HELPER_READ:	readRange(reader, reply); break;
+			case HELPER_WRITE:	writeRange(reader, reply); break;
+			default:			reply.putU8(HELPER_STATUS_MALFORMED); break;
+		}
+		
+		string frame = reply.frame();
+		
+		if (!writeExact(STDOUT_FILENO, frame.c_str(), frame.length()))
+			break;
+	}
+	
+	return 0;
+}
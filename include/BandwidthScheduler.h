@@ -0,0 +1,61 @@
+#ifndef BANDWIDTHSCHEDULER_H
+#define BANDWIDTHSCHEDULER_H
+
+#include <string>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+enum {
+	PRIORITY_INTERACTIVE,
+	PRIORITY_BULK,
+	PRIORITY_MAX
+};
+
+// Token bucket shared by every session. Waiting hosts share it by deficit round robin within a
+// priority, so each gets the same bytes whatever its request sizes, and interactive traffic
+// always goes before bulk transfers when priorities are enabled
+class BandwidthScheduler {
+public:
+	BandwidthScheduler();
+	
+	void setRate(size_t bytes_per_second);
+	void setPrioritized(bool prioritized);
+	void acquire(const std::string& host, size_t bytes, int priority);
+
+private:
+	struct Request {
+		size_t bytes_;
+		bool granted_;
+	};
+	
+	struct HostQueue {
+		std::deque<Request*> requests_;
+		// Bytes the host may still send this round, and whether its quantum was added already
+		size_t deficit_;
+		bool turn_;
+		// A host usually has a single request out, so it steps out of line between requests and
+		// keeps its deficit for when it's back
+		bool queued_;
+	};
+	
+	void refill();
+	double dispatch();
+	
+	std::mutex mutex_;
+	std::condition_variable granted_;
+	
+	size_t rate_;
+	bool prioritized_;
+	double tokens_;
+	double capacity_;
+	std::chrono::steady_clock::time_point last_refill_;
+	
+	// Hosts with waiting requests in serving order, and each host's own queue, kept while it's idle
+	std::deque<std::string> rounds_[PRIORITY_MAX];
+	std::unordered_map<std::string, HostQueue> waiting_[PRIORITY_MAX];
+};
+
+#endif
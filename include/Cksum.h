@@ -0,0 +1,11 @@
+#ifndef CKSUM_H
+#define CKSUM_H
+
+#include <string>
+#include <cstdint>
+
+// POSIX cksum, start with crc 0 and finish with the total length to get "<crc> <length>"
+uint32_t cksumUpdate(uint32_t crc, const char* data, size_t length);
+std::string cksumFinish(uint32_t crc, uint64_t length);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef HELPERPROTOCOL_H
+#define HELPERPROTOCOL_H
+
+#include <string>
+#include <cstdint>
+
+// Binary protocol spoken with nessh-helper over one long-lived channel. Every frame is a little
+// endian u32 payload length followed by the payload, whose first byte is the opcode in requests
+// and the status in replies. Requests carry whole batches so one frame is one round trip.
+enum {
+	HELPER_QUIT,
+	HELPER_STAT,		// u32 count, count * string path -> count * (u8 exists, u32 mode, u64 size, u64 mtime)
+	HELPER_HASH,		// u32 count, count * string path -> count * (u8 ok, u32 crc, u64 size), unfinished POSIX cksum
+	HELPER_EXEC,		// string command -> u32 exit status, string output
+	HELPER_READ,		// string path, u64 offset, u32 length -> string data
+	HELPER_WRITE		// string path, u64 offset, string data -> nothing
+};
+
+enum {
+	HELPER_STATUS_OK,
+	HELPER_STATUS_ERROR,
+	HELPER_STATUS_MALFORMED
+};
+
+const uint32_t HELPER_MAX_FRAME = 64 * 1024 * 1024;
+
+struct HelperStat {
+	bool exists_;
+	uint32_t mode_;
+	uint64_t size_;
+	uint64_t mtime_;
+};
+
+class HelperWriter {
+public:
+	void putU8(uint8_t value);
+	void putU32(uint32_t value);
+	void putU64(uint64_t value);
+	void putString(const std::string& value);
+	void putRaw(const HelperWriter& other);
+	
+	std::string frame() const;
+
+private:
+	std::string payload_;
+};
+
+class HelperReader {
+public:
+	explicit HelperReader(const std::string& payload);
+	
+	bool getU8(uint8_t& value);
+	bool getU32(uint32_t& value);
+	bool getU64(uint64_t& value);
+	bool getString(std::string& value);
+
+private:
+	const std::string& payload_;
+	size_t position_;
+};
+
+#endif
@@ -3,28 +3,76 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <functional>
 
 // Fuck the C++ wrapper
 #include <libssh/libssh.h>
+#include <libssh/sftp.h>
+
+#include "HelperProtocol.h"
+#include "BandwidthScheduler.h"
+
+class SSHBastion;
 
 class SSH {
 public:
 	SSH(const std::string& ip, const std::string& pass);
 	SSH(const std::string& ip, const std::string& user, const std::string& pass);
+	~SSH();
+	
+	// Owns its ssh_session, so it can be moved but never copied
+	SSH(const SSH&) = delete;
+	SSH& operator=(const SSH&) = delete;
+	SSH(SSH&& other) noexcept;
+	SSH& operator=(SSH&& other) noexcept;
 	
 	bool connect();
 	void disconnect();
-	bool command(const std::string& command, bool output_file = false, bool output_vector = false);
-	bool transferLocal(const std::string& from, const std::string& to, const std::string& custom_filename);
-	bool transferRemote(const std::string& from, const std::string& to, bool overwrite = true);
+	bool command(const std::string& command, bool output_file = false, bool output_vector = false, bool persistent_shell = false);
+	bool commandInput(const std::string& command, const std::function<bool(std::shared_ptr<const std::string>&)>& next_chunk, bool output_file = false, bool output_vector = false);
+	bool transferLocal(const std::string& from, const std::string& to, const std::string& custom_filename, bool resumable = false, bool verify = false);
+	bool transferRemote(const std::string& from, const std::string& to, bool overwrite = true, bool resumable = false, bool verify = false);
+	
+	void setBastion(SSHBastion* bastion);
+	void setScheduler(BandwidthScheduler* scheduler);
+	
+	bool deployHelper(const std::string& local_helper, const std::string& remote_directory);
+	bool startHelper(const std::string& remote_path);
+	void stopHelper();
+	bool helperStat(const std::vector<std::string>& paths, std::vector<HelperStat>& results);
+	bool helperHash(const std::vector<std::string>& paths, std::vector<std::string>& digests);
+	bool helperExec(const std::string& command, std::string& output);
+	bool helperRead(const std::string& path, uint64_t offset, uint32_t length, std::string& data);
+	bool helperWrite(const std::string& path, uint64_t offset, const std::string& data);
 	
 	void clearOutput();
 	std::vector<std::string> getOutput();
+	int getExitStatus();
+	
+	const std::string& getIP() const;
+	const std::string& getHelperPath() const;
+	bool isConnected() const;
 	
 	bool operator==(const std::string& ip);
 	
 private:
+	void throttle(size_t bytes, int priority);
 	bool fileExists(const std::string& path, const std::string& filename);
+	std::vector<bool> filesExist(const std::string& path, const std::vector<std::string>& filenames);
+	bool helperRequest(const HelperWriter& request, std::string& reply);
+	bool captureCommand(const std::string& command, std::string& output);
+	bool hashRemotePrefix(const std::string& path, uint64_t length, std::string& digest);
+	bool transferRemoteResumable(const std::string& filename, const std::string& remote_path);
+	bool transferLocalResumable(const std::string& from, const std::string& local_path);
+	bool transferRemoteVerified(const std::string& filename, const std::string& remote_path);
+	bool transferLocalVerified(const std::string& from, const std::string& local_path);
+	bool verifyCopy(const std::string& local_path, const std::string& remote_path);
+	sftp_session openSftp();
+	ssh_channel openExecChannel(const std::string& command);
+	bool openShell();
+	void closeShell();
+	bool shellCommand(const std::string& command, std::string& output);
 	
 	std::string ip_;
 	std::string user_;
@@ -32,8 +80,20 @@ private:
 	
 	bool connected_;
 	ssh_session session_;
+	SSHBastion* bastion_;
+	BandwidthScheduler* scheduler_;
 	
 	std::vector<std::string> output_;
+	int exit_status_;
+	
+	// Long-lived shell channel reused by sequential commands
+	ssh_channel shell_;
+	size_t shell_commands_;
+	
+	// Channel to nessh-helper, batched metadata requests go here when it's running
+	ssh_channel helper_;
+	// Where the helper was last started from, kept across disconnects so it can be restarted
+	std::string helper_path_;
 };
 
 #endif
\ No newline at end of file
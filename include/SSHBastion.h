@@ -0,0 +1,73 @@
+#ifndef SSHBASTION_H
+#define SSHBASTION_H
+
+#include <string>
+#include <list>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+#include <libssh/libssh.h>
+#include <libssh/callbacks.h>
+
+// One authenticated session to a jump host, carrying many direct-tcpip channels
+class SSHBastion {
+public:
+	SSHBastion(const std::string& ip, const std::string& user, const std::string& pass);
+	~SSHBastion();
+	
+	bool connect();
+	void disconnect();
+	int openTunnel(const std::string& host, int port);
+	size_t getTunnelCount();
+	// False once the session to the jump host was lost, its tunnels are gone by then
+	bool isAlive();
+	
+private:
+	struct Tunnel {
+		ssh_channel channel_;
+		int socket_;
+		
+		// Channel data is handed to us by libssh while it processes packets
+		ssh_channel_callbacks_struct callbacks_;
+		bool backlogged_;
+		bool remote_eof_;
+		bool closed_;
+		
+		// Opened by the pump, openTunnel() waits for the bastion's reply without holding the lock
+		bool opening_;
+		bool failed_;
+		std::string host_;
+		int port_;
+		
+		std::string to_channel_;
+		std::string to_socket_;
+	};
+	
+	static int onChannelData(ssh_session session, ssh_channel channel, void* data, uint32_t length, int is_stderr, void* userdata);
+	static void onChannelEof(ssh_session session, ssh_channel channel, void* userdata);
+	
+	void pump();
+	void continueOpen(Tunnel& tunnel);
+	void serviceTunnel(Tunnel& tunnel, short requested, short returned, char* buffer, size_t buffer_size);
+	void closeTunnel(Tunnel& tunnel);
+	
+	std::string ip_;
+	std::string user_;
+	std::string pass_;
+	
+	bool connected_;
+	ssh_session session_;
+	ssh_event event_;
+	
+	std::mutex mutex_;
+	std::condition_variable opened_;
+	std::thread pump_thread_;
+	std::atomic<bool> running_;
+	
+	// Tunnels are referenced by their channel callbacks, a list keeps them in place
+	std::list<Tunnel> tunnels_;
+};
+
+#endif
@@ -2,46 +2,143 @@
 #define SSHMASTER_H
 
 #include "SSH.h"
+#include "SSHBastion.h"
 
 #include <vector>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
 #include <mutex>
+#include <condition_variable>
+#include <functional>
 
 enum {
 	SETTING_USE_ACTUAL_FILENAME,
 	SETTING_ENABLE_SSH_OUTPUT,
 	SETTING_ENABLE_SSH_OUTPUT_VECTOR_STYLE,
+	SETTING_USE_PERSISTENT_SHELL,
+	SETTING_RESUMABLE_TRANSFERS,
+	SETTING_VERIFY_TRANSFERS,
 	SETTING_MAX
 };
 
+class SSHMaster;
+
+// Keeps a pooled session from being evicted for as long as it's held
+class SessionLease {
+public:
+	SessionLease(SessionLease&& other) noexcept;
+	~SessionLease();
+	
+	SessionLease(const SessionLease&) = delete;
+	SessionLease& operator=(const SessionLease&) = delete;
+	
+	SSH& operator*() const;
+	SSH* operator->() const;
+	
+private:
+	friend class SSHMaster;
+	
+	SessionLease(SSHMaster& master, const std::string& ip, SSH& session);
+	
+	SSHMaster* master_;
+	std::string ip_;
+	SSH* session_;
+};
+
+struct PoolStatistics {
+	size_t hosts_;
+	size_t open_sessions_;
+	size_t peak_sessions_;
+	size_t connects_;
+	size_t evictions_;
+	size_t open_descriptors_;
+	// Process-wide approximation, not a per-session measurement: resident memory growth since the
+	// SSHMaster was created, including thread stacks, transfer buffers and collected output. It
+	// doesn't shrink after evictions since the allocator keeps freed memory around
+	size_t process_growth_bytes_;
+	size_t process_growth_per_session_;
+};
+
 class SSHMaster {
 public:
 	SSHMaster();
 	~SSHMaster();
 	
+	// With a pool size set, connect() only registers hosts and at most max_sessions stay open,
+	// connected on first use and evicted least recently used first
+	bool setPoolSize(size_t max_sessions);
+	PoolStatistics getPoolStatistics();
+	
+	void setBandwidthLimit(size_t bytes_per_second, bool prioritize_commands = true);
+	
 	bool connect(const std::string& ip, const std::string& pass);
 	bool connect(const std::string& ip, const std::string& user, const std::string& pass);
 	bool connect(const std::vector<std::string>& ips, const std::string& pass);
 	bool connect(const std::vector<std::string>& ips, const std::vector<std::string>& users, const std::vector<std::string>& passwords);
+	bool setBastion(const std::string& ip, const std::string& user, const std::string& pass, size_t sessions = 4);
+	// With a pool size set every host is probed by opening a session, which may evict others
 	std::vector<bool> connectResult(const std::vector<std::string>& ips, const std::string& pass);
 	std::vector<std::pair<std::string, std::vector<std::string>>> command(const std::vector<std::string>& ips, const std::vector<std::string>& commands);
+	// The input is read once and streamed to every host, with a pool size set ips may not outnumber it
+	std::vector<std::pair<std::string, std::vector<std::string>>> commandInput(const std::vector<std::string>& ips, const std::string& command, int fd);
+	std::vector<std::pair<std::string, std::vector<std::string>>> commandInput(const std::vector<std::string>& ips, const std::string& command, const std::string& filename);
+	std::vector<std::pair<std::string, std::vector<std::string>>> commandInput(const std::vector<std::string>& ips, const std::string& command, const std::function<ssize_t(char*, size_t)>& generator);
 	bool transferLocal(const std::vector<std::string>& ips, const std::vector<std::string>& from, const std::vector<std::string>& to, bool threading);
 	bool transferRemote(const std::vector<std::string>& ips, const std::vector<std::string>& from, const std::vector<std::string>& to, bool overwrite = true);
 	
+	// Uploads the helper on every call, remote_directory is relative to the remote home and must be private to the user
+	bool deployHelper(const std::vector<std::string>& ips, const std::string& local_helper, const std::string& remote_directory = ".nessh");
+	std::vector<std::pair<std::string, std::vector<HelperStat>>> stat(const std::vector<std::string>& ips, const std::vector<std::string>& paths);
+	
 	void setSetting(int setting, bool value);
 	bool getSetting(int setting);
 	
 	void setThreadedConnectionStatus(bool status);
+	// With a pool size set, a session from getSession may be disconnected by any later pool operation
+	// and only reconnects on the next acquire, hold a lease from acquireSession for as long as it's in use
 	SSH& getSession(const std::string& ip, bool threading);
+	SessionLease acquireSession(const std::string& ip);
 	
 	void setConnectResult(size_t id, bool status);
 	
 private:
+	friend class SessionLease;
+	
+	SSHBastion* pickBastion();
+	SSH& acquirePooledSession(const std::string& ip);
+	void releaseSession(const std::string& ip);
+	bool evictIdleSession(std::string& evicted);
+	void runThreaded(size_t count, const std::function<void(size_t)>& work);
+	
 	bool threaded_connections_result_;
 	std::mutex threaded_connections_mutex_;
 	
 	std::vector<bool> threaded_online_result_;
 	
-	std::vector<SSH> connections_;
+	// Sessions are never removed, references to them stay valid for as long as the master lives
+	std::list<SSH> connections_;
+	std::unordered_map<std::string, std::list<SSH>::iterator> sessions_;
+	
+	// Pooled hosts with an open session, most recently used first
+	std::list<std::string> open_;
+	std::unordered_map<std::string, std::list<std::string>::iterator> open_positions_;
+	
+	size_t pool_size_;
+	std::unordered_map<std::string, std::pair<std::string, std::string>> hosts_;
+	std::unordered_map<std::string, size_t> in_use_;
+	// Hosts being connected or evicted outside the lock
+	std::unordered_set<std::string> busy_;
+	std::condition_variable pool_changed_;
+	
+	size_t peak_sessions_;
+	size_t connects_;
+	size_t evictions_;
+	size_t baseline_resident_bytes_;
+	
+	std::vector<SSHBastion*> bastions_;
+	BandwidthScheduler scheduler_;
+	size_t next_bastion_;
 	std::vector<bool> settings_;
 };
 
@@ -0,0 +1,162 @@
+#include "BandwidthScheduler.h"
+
+#include <algorithm>
+
+using namespace std;
+
+// The bucket holds at most BURST_SECONDS worth of tokens, small enough to keep the aggregate rate
+// steady but never less than MINIMUM_BURST so regular transfer buffers fit
+static const double BURST_SECONDS = 0.05;
+static const double MINIMUM_BURST = 65536;
+// Bytes added to a waiting host's deficit per round, as small as the usual transfer buffer
+static const size_t QUANTUM = 16384;
+
+BandwidthScheduler::BandwidthScheduler() :
+	rate_(0), prioritized_(true), tokens_(0), capacity_(MINIMUM_BURST) {
+	last_refill_ = chrono::steady_clock::now();
+}
+
+void BandwidthScheduler::setRate(size_t bytes_per_second) {
+	lock_guard<mutex> guard(mutex_);
+	
+	rate_ = bytes_per_second;
+	capacity_ = max(rate_ * BURST_SECONDS, MINIMUM_BURST);
+	tokens_ = min(tokens_, capacity_);
+	last_refill_ = chrono::steady_clock::now();
+	
+	// Anyone waiting has to recompute, or leave if the limit was lifted
+	granted_.notify_all();
+}
+
+void BandwidthScheduler::setPrioritized(bool prioritized) {
+	lock_guard<mutex> guard(mutex_);
+	prioritized_ = prioritized;
+}
+
+void BandwidthScheduler::refill() {
+	auto now = chrono::steady_clock::now();
+	double elapsed = chrono::duration<double>(now - last_refill_).count();
+	
+	tokens_ = min(capacity_, tokens_ + elapsed * rate_);
+	last_refill_ = now;
+}
+
+// Grants as many waiting requests as the bucket allows, returns the seconds until the next one fits
+double BandwidthScheduler::dispatch() {
+	refill();
+	bool granted = false;
+	double wait = 0;
+	
+	for (int level = 0; level < PRIORITY_MAX && wait == 0; level++) {
+		auto& rounds = rounds_[level];
+		
+		while (!rounds.empty()) {
+			string host = rounds.front();
+			auto& queue = waiting_[level][host];
+			
+			// Nothing to send right now, the next host goes instead and this one gets its place back later
+			if (queue.requests_.empty()) {
+				queue.queued_ = false;
+				rounds.pop_front();
+				
+				continue;
+			}
+			
+			Request* request = queue.requests_.front();
+			
+			if (!queue.turn_) {
+				queue.deficit_ += QUANTUM;
+				queue.turn_ = true;
+			}
+			
+			// Not enough credit yet, it carries over to the host's next turn
+			if (request->bytes_ > queue.deficit_) {
+				queue.turn_ = false;
+				rounds.pop_front();
+				rounds.push_back(host);
+				
+				continue;
+			}
+			
+			// Requests larger than the bucket go through once it's full and leave it in debt
+			double needed = min((double)request->bytes_, capacity_);
+			
+			if (tokens_ < needed) {
+				wait = (needed - tokens_) / rate_;
+				break;
+			}
+			
+			tokens_ -= request->bytes_;
+			queue.deficit_ -= request->bytes_;
+			request->granted_ = true;
+			granted = true;
+			
+			queue.requests_.pop_front();
+			
+			// A host keeps its turn while the credit lasts, even one that has to step out of line until
+			// its next request
+			if (queue.requests_.empty()) {
+				queue.queued_ = false;
+				rounds.pop_front();
+			}
+		}
+	}
+	
+	if (granted)
+		granted_.notify_all();
+	
+	return wait;
+}
+
+void BandwidthScheduler::acquire(const string& host, size_t bytes, int priority) {
+	unique_lock<mutex> lock(mutex_);
+	
+	if (rate_ == 0 || bytes == 0)
+		return;
+	
+	int level = prioritized_ ? priority : PRIORITY_BULK;
+	Request request = { bytes, false };
+	auto inserted = waiting_[level].insert({ host, HostQueue() });
+	auto& queue = inserted.first->second;
+	
+	if (inserted.second) {
+		queue.deficit_ = 0;
+		queue.turn_ = false;
+		queue.queued_ = false;
+	}
+	
+	// New hosts join at the back, one that stepped out goes first so it doesn't lose its turn or credit
+	if (!queue.queued_) {
+		queue.queued_ = true;
+		
+		if (inserted.second)
+			rounds_[level].push_back(host);
+		else
+			rounds_[level].push_front(host);
+	}
+	
+	queue.requests_.push_back(&request);
+	
+	while (!request.granted_) {
+		// Limit lifted while waiting, let everyone through
+		if (rate_ == 0) {
+			for (int i = 0; i < PRIORITY_MAX; i++) {
+				for (auto& waiting : waiting_[i])
+					for_each(waiting.second.requests_.begin(), waiting.second.requests_.end(), [] (Request* other) { other->granted_ = true; });
+					
+				waiting_[i].clear();
+				rounds_[i].clear();
+			}
+			
+			granted_.notify_all();
+			break;
+		}
+		
+		double wait = dispatch();
+		
+		if (request.granted_)
+			break;
+			
+		granted_.wait_for(lock, chrono::duration<double>(max(wait, 0.001)));
+	}
+}
@@ -0,0 +1,55 @@
+#include "Cksum.h"
+
+using namespace std;
+
+// POSIX cksum (CRC-32, polynomial 0x04C11DB7), matches the remote cksum utility. Uses slicing-by-8
+// tables so checksumming keeps up with the transfer loops
+struct CksumTable {
+	uint32_t slices[8][256];
+	
+	CksumTable() {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t value = i << 24;
+			
+			for (int bit = 0; bit < 8; bit++)
+				value = value & 0x80000000 ? (value << 1) ^ 0x04C11DB7 : value << 1;
+				
+			slices[0][i] = value;
+		}
+		
+		for (int slice = 1; slice < 8; slice++)
+			for (uint32_t i = 0; i < 256; i++)
+				slices[slice][i] = (slices[slice - 1][i] << 8) ^ slices[0][slices[slice - 1][i] >> 24];
+	}
+};
+
+uint32_t cksumUpdate(uint32_t crc, const char* data, size_t length) {
+	static const CksumTable table;
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+	const auto& slices = table.slices;
+	
+	while (length >= 8) {
+		uint32_t word = crc ^ ((uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3]);
+		
+		crc = slices[7][word >> 24] ^ slices[6][(word >> 16) & 0xFF] ^ slices[5][(word >> 8) & 0xFF] ^ slices[4][word & 0xFF] ^
+			slices[3][bytes[4]] ^ slices[2][bytes[5]] ^ slices[1][bytes[6]] ^ slices[0][bytes[7]];
+			
+		bytes += 8;
+		length -= 8;
+	}
+	
+	while (length-- > 0)
+		crc = (crc << 8) ^ slices[0][((crc >> 24) ^ *bytes++) & 0xFF];
+		
+	return crc;
+}
+
+string cksumFinish(uint32_t crc, uint64_t length) {
+	// The length is appended with as few bytes as possible, least significant first
+	for (uint64_t left = length; left != 0; left >>= 8) {
+		char byte = left & 0xFF;
+		crc = cksumUpdate(crc, &byte, 1);
+	}
+	
+	return to_string(~crc & 0xFFFFFFFF) + " " + to_string(length);
+}
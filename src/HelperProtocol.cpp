@@ -0,0 +1,80 @@
+#include "HelperProtocol.h"
+
+using namespace std;
+
+void HelperWriter::putU8(uint8_t value) {
+	payload_.push_back(value);
+}
+
+void HelperWriter::putU32(uint32_t value) {
+	for (int i = 0; i < 4; i++)
+		payload_.push_back((value >> (i * 8)) & 0xFF);
+}
+
+void HelperWriter::putU64(uint64_t value) {
+	for (int i = 0; i < 8; i++)
+		payload_.push_back((value >> (i * 8)) & 0xFF);
+}
+
+void HelperWriter::putString(const string& value) {
+	putU32(value.length());
+	payload_ += value;
+}
+
+void HelperWriter::putRaw(const HelperWriter& other) {
+	payload_ += other.payload_;
+}
+
+string HelperWriter::frame() const {
+	HelperWriter header;
+	header.putU32(payload_.length());
+	
+	return header.payload_ + payload_;
+}
+
+HelperReader::HelperReader(const string& payload) :
+	payload_(payload), position_(0) {}
+
+bool HelperReader::getU8(uint8_t& value) {
+	if (position_ + 1 > payload_.length())
+		return false;
+	
+	value = payload_.at(position_++);
+	return true;
+}
+
+bool HelperReader::getU32(uint32_t& value) {
+	if (position_ + 4 > payload_.length())
+		return false;
+	
+	value = 0;
+	
+	for (int i = 0; i < 4; i++)
+		value |= (uint32_t)(unsigned char)payload_.at(position_++) << (i * 8);
+	
+	return true;
+}
+
+bool HelperReader::getU64(uint64_t& value) {
+	if (position_ + 8 > payload_.length())
+		return false;
+	
+	value = 0;
+	
+	for (int i = 0; i < 8; i++)
+		value |= (uint64_t)(unsigned char)payload_.at(position_++) << (i * 8);
+	
+	return true;
+}
+
+bool HelperReader::getString(string& value) {
+	uint32_t length;
+	
+	if (!getU32(length) || position_ + length > payload_.length())
+		return false;
+	
+	value = payload_.substr(position_, length);
+	position_ += length;
+	
+	return true;
+}
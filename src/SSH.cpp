@@ -1,13 +1,22 @@
 #include "SSH.h"
+#include "SSHBastion.h"
+#include "Cksum.h"
 
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <deque>
 #include <chrono>
+#include <cstdlib>
+#include <algorithm>
+#include <cctype>
 
 #include <sys/stat.h>
 #include <libssh/sftp.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <errno.h>
 
 #define ERROR(...)	do { fprintf(stderr, "Error: "); fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); exit(1); } while(0)
 
@@ -18,6 +27,13 @@ SSH::SSH(const string& ip, const string& pass) :
 	user_ = "";
 	
 	connected_ = false;
+	session_ = NULL;
+	exit_status_ = -1;
+	shell_ = NULL;
+	shell_commands_ = 0;
+	bastion_ = nullptr;
+	scheduler_ = nullptr;
+	helper_ = NULL;
 }
 
 SSH::SSH(const string& ip, const string& user, const string& pass) {
@@ -26,6 +42,57 @@ SSH::SSH(const string& ip, const string& user, const string& pass) {
 	pass_ = pass;
 	
 	connected_ = false;
+	session_ = NULL;
+	exit_status_ = -1;
+	shell_ = NULL;
+	shell_commands_ = 0;
+	bastion_ = nullptr;
+	scheduler_ = nullptr;
+	helper_ = NULL;
+}
+
+// Moving hands over the session and its channels, the source is left disconnected
+SSH::SSH(SSH&& other) noexcept :
+	ip_(move(other.ip_)), user_(move(other.user_)), pass_(move(other.pass_)),
+	connected_(other.connected_), session_(other.session_), bastion_(other.bastion_), scheduler_(other.scheduler_),
+	output_(move(other.output_)), exit_status_(other.exit_status_),
+	shell_(other.shell_), shell_commands_(other.shell_commands_), helper_(other.helper_), helper_path_(move(other.helper_path_)) {
+	other.connected_ = false;
+	other.session_ = NULL;
+	other.shell_ = NULL;
+	other.helper_ = NULL;
+}
+
+SSH& SSH::operator=(SSH&& other) noexcept {
+	if (this == &other)
+		return *this;
+		
+	disconnect();
+	
+	ip_ = move(other.ip_);
+	user_ = move(other.user_);
+	pass_ = move(other.pass_);
+	connected_ = other.connected_;
+	session_ = other.session_;
+	bastion_ = other.bastion_;
+	scheduler_ = other.scheduler_;
+	output_ = move(other.output_);
+	exit_status_ = other.exit_status_;
+	shell_ = other.shell_;
+	shell_commands_ = other.shell_commands_;
+	helper_ = other.helper_;
+	helper_path_ = move(other.helper_path_);
+	
+	other.connected_ = false;
+	other.session_ = NULL;
+	other.shell_ = NULL;
+	other.helper_ = NULL;
+	
+	return *this;
+}
+
+SSH::~SSH() {
+	disconnect();
 }
 
 void SSH::clearOutput() {
@@ -36,12 +103,34 @@ vector<string> SSH::getOutput() {
 	return output_;
 }
 
+void SSH::setBastion(SSHBastion* bastion) {
+	bastion_ = bastion;
+}
+
+void SSH::setScheduler(BandwidthScheduler* scheduler) {
+	scheduler_ = scheduler;
+}
+
+void SSH::throttle(size_t bytes, int priority) {
+	if (scheduler_ != nullptr)
+		scheduler_->acquire(ip_, bytes, priority);
+}
+
+int SSH::getExitStatus() {
+	return exit_status_;
+}
+
 void SSH::disconnect() {
 	if (!connected_)
 		return;
 		
+	closeShell();
+	stopHelper();
 	ssh_disconnect(session_);
 	ssh_free(session_);
+	
+	session_ = NULL;
+	connected_ = false;
 }
 
 static vector<string> splitString(const string& input, char split) {
@@ -71,56 +160,977 @@ static string getFilenameFromPath(const string& path) {
 	return "";		
 }
 
-static size_t getFileSize(string& filename) {
+static size_t getFileSize(const string& filename) {
 	ifstream file(filename, ios::binary | ios::ate);
 	
-	if (!file.is_open()) {
-		cout << "Warning: could not open file to get file size\n";
+	if (!file.is_open()) {
+		cout << "Warning: could not open file to get file size\n";
+		
+		return 0;
+	}
+	
+	size_t size = file.tellg();
+	file.close();
+	
+	return size;
+}
+
+sftp_session SSH::openSftp() {
+	sftp_session sftp = sftp_new(session_);
+	
+	if (sftp == NULL) {
+		cout << "ERROR: Allocating SFTP session: " << ssh_get_error(session_) << endl;
+		
+		return NULL;
+	}
+	
+	if (sftp_init(sftp) != SSH_OK) {
+		cout << "ERROR: Initializing SFTP session: " << sftp_get_error(sftp) << endl;
+		
+		sftp_free(sftp);
+		return NULL;
+	}
+	
+	return sftp;
+}
+
+bool SSH::fileExists(const string& path, const string& filename) {
+	vector<HelperStat> results;
+	
+	if (helper_ != NULL && helperStat({ path + filename }, results))
+		return results.front().exists_;
+		
+	sftp_session sftp = openSftp();
+	
+	if (sftp == NULL)
+		return false;
+		
+	sftp_file file = sftp_open(sftp, (path + filename).c_str(), O_RDONLY, 0);
+	bool result = false;
+	
+	if (file != NULL) {
+		sftp_close(file);
+		result = true;
+	}
+	
+	sftp_free(sftp);
+	return result;
+}
+
+static bool hashLocalPrefix(const string& filename, uint64_t length, string& digest) {
+	ifstream file(filename, ios::binary);
+	
+	if (!file.is_open())
+		return false;
+		
+	const size_t FILE_BUFFER_SIZE = 16384;
+	char file_buffer[FILE_BUFFER_SIZE];
+	uint32_t crc = 0;
+	uint64_t left = length;
+	
+	while (left > 0) {
+		size_t read_amount = left > FILE_BUFFER_SIZE ? FILE_BUFFER_SIZE : left;
+		file.read(file_buffer, read_amount);
+		
+		if (!file)
+			return false;
+			
+		crc = cksumUpdate(crc, file_buffer, read_amount);
+		left -= read_amount;
+	}
+	
+	digest = cksumFinish(crc, length);
+	return true;
+}
+
+static void trimTrailingWhitespace(string& input) {
+	while (!input.empty() && isspace((unsigned char)input.back()))
+		input.pop_back();
+}
+
+static string shellQuote(const string& input) {
+	string quoted = "'";
+	
+	for (char character : input) {
+		if (character == '\'')
+			quoted += "'\\''";
+		else
+			quoted += character;
+	}
+	
+	return quoted + "'";
+}
+
+bool SSH::captureCommand(const string& command, string& output) {
+	ssh_channel channel = openExecChannel(command);
+	
+	if (channel == NULL)
+		return false;
+		
+	char buffer[256];
+	output.clear();
+	
+	while (true) {
+		int bytes_received = ssh_channel_read(channel, buffer, sizeof(buffer), 0);
+		
+		if (bytes_received <= 0)
+			break;
+			
+		output.append(buffer, bytes_received);
+	}
+	
+	int status = ssh_channel_get_exit_status(channel);
+	
+	ssh_channel_send_eof(channel);
+	ssh_channel_close(channel);
+	ssh_channel_free(channel);
+	
+	return status == 0;
+}
+
+bool SSH::hashRemotePrefix(const string& path, uint64_t length, string& digest) {
+	if (!captureCommand("head -c " + to_string(length) + " " + shellQuote(path) + " | cksum", digest))
+		return false;
+		
+	trimTrailingWhitespace(digest);
+		
+	return true;
+}
+
+// Journals are kept together in ~/.nessh/resume rather than next to the transferred files, the
+// name only has to tell transfers apart since the key inside is compared on every read
+static string getJournalPath(const string& ip, const string& identity) {
+	const char* home = getenv("HOME");
+	
+	if (home == NULL || *home == '\0') {
+		passwd* entry = getpwuid(getuid());
+		home = entry != NULL ? entry->pw_dir : "";
+	}
+	
+	string directory = string(home) + "/.nessh";
+	
+	for (const string& path : { directory, directory + "/resume" })
+		if (mkdir(path.c_str(), S_IRWXU) != 0 && errno != EEXIST)
+			cout << "Warning: could not create " << path << " for resume journals\n";
+			
+	char name[16];
+	snprintf(name, sizeof(name), "%08x", cksumUpdate(0, identity.c_str(), identity.length()));
+	
+	return directory + "/resume/" + ip + "-" + name + ".resume";
+}
+
+// Journal lines are "<key>\n<offset>\n", the key identifies what the offset belongs to
+static bool readJournal(const string& journal, const string& key, uint64_t& offset) {
+	ifstream file(journal);
+	
+	if (!file.is_open())
+		return false;
+		
+	string stored_key;
+	
+	if (!getline(file, stored_key) || stored_key != key)
+		return false;
+		
+	return static_cast<bool>(file >> offset);
+}
+
+static bool writeJournal(const string& journal, const string& key, uint64_t offset) {
+	string temporary = journal + ".tmp";
+	string content = key + "\n" + to_string(offset) + "\n";
+	int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	
+	if (fd < 0)
+		return false;
+		
+	bool written = write(fd, content.c_str(), content.length()) == (ssize_t)content.length() && fsync(fd) == 0;
+	close(fd);
+	
+	// Rename last so a crash leaves either the old or the new checkpoint, never half of one
+	return written && rename(temporary.c_str(), journal.c_str()) == 0;
+}
+
+vector<bool> SSH::filesExist(const string& path, const vector<string>& filenames) {
+	vector<bool> exists;
+	vector<string> paths;
+	vector<HelperStat> results;
+	
+	for_each(filenames.begin(), filenames.end(), [&path, &paths] (const string& filename) { paths.push_back(path + filename); });
+	
+	if (helper_ != NULL && helperStat(paths, results)) {
+		for_each(results.begin(), results.end(), [&exists] (const HelperStat& result) { exists.push_back(result.exists_); });
+		
+		return exists;
+	}
+	
+	for_each(filenames.begin(), filenames.end(), [this, &path, &exists] (const string& filename) { exists.push_back(fileExists(path, filename)); });
+	
+	return exists;
+}
+
+bool SSH::deployHelper(const string& local_helper, const string& remote_directory) {
+	if (!connected_) {
+		cout << "Error: could not deploy helper, we're not connected\n";
+		
+		return false;
+	}
+	
+	string directory = remote_directory;
+	
+	while (directory.length() > 1 && directory.back() == '/')
+		directory.pop_back();
+		
+	string quoted = shellQuote(directory);
+	string ignored;
+	
+	// The helper is executed, often as root, so it must live somewhere only we can write to
+	if (!captureCommand("mkdir -p -m 700 " + quoted + " && test -d " + quoted + " && test ! -L " + quoted + " && test -O " + quoted +
+		" && test -z \"$(find " + quoted + " -maxdepth 0 -perm /022)\"", ignored)) {
+		cout << "Error: " << remote_directory << " on " << ip_ << " must be a directory owned by us and writable by no one else\n";
+		
+		return false;
+	}
+	
+	// Our own helper may be running from the file we're about to replace
+	stopHelper();
+	
+	string filename = getFilenameFromPath(local_helper);
+	string remote_path = directory + "/" + (filename == "" ? local_helper : filename);
+	string temporary = remote_path + "." + to_string(chrono::steady_clock::now().time_since_epoch().count()) + ".new";
+	
+	// Always upload, whatever is already there can't be trusted to be our helper. A running binary
+	// can't be written to (ETXTBSY) but it can be renamed over, other nessh processes may still
+	// be using the old one
+	if (!transferRemoteVerified(local_helper, temporary) || !captureCommand("mv -f " + shellQuote(temporary) + " " + shellQuote(remote_path), ignored)) {
+		cout << "Error: could not upload helper to " << ip_ << endl;
+		
+		captureCommand("rm -f " + shellQuote(temporary), ignored);
+		return false;
+	}
+	
+	return startHelper(remote_path);
+}
+
+bool SSH::startHelper(const string& remote_path) {
+	stopHelper();
+	helper_ = openExecChannel(shellQuote(remote_path));
+	
+	if (helper_ == NULL)
+		return false;
+		
+	helper_path_ = remote_path;
+	
+	return true;
+}
+
+void SSH::stopHelper() {
+	if (helper_ == NULL)
+		return;
+		
+	HelperWriter request;
+	request.putU8(HELPER_QUIT);
+	string frame = request.frame();
+	
+	ssh_channel_write(helper_, frame.c_str(), frame.length());
+	ssh_channel_send_eof(helper_);
+	ssh_channel_close(helper_);
+	ssh_channel_free(helper_);
+	helper_ = NULL;
+}
+
+static bool readChannelExact(ssh_channel channel, char* buffer, size_t length) {
+	while (length > 0) {
+		int bytes_received = ssh_channel_read(channel, buffer, length, 0);
+		
+		if (bytes_received <= 0)
+			return false;
+			
+		buffer += bytes_received;
+		length -= bytes_received;
+	}
+	
+	return true;
+}
+
+bool SSH::helperRequest(const HelperWriter& request, string& reply) {
+	if (helper_ == NULL) {
+		cout << "Error: no helper running on " << ip_ << endl;
+		
+		return false;
+	}
+	
+	string frame = request.frame();
+	char header[4];
+	
+	throttle(frame.length(), PRIORITY_INTERACTIVE);
+	
+	if (ssh_channel_write(helper_, frame.c_str(), frame.length()) != (int)frame.length() || !readChannelExact(helper_, header, sizeof(header))) {
+		cout << "Error: lost helper on " << ip_ << endl;
+		
+		stopHelper();
+		return false;
+	}
+	
+	string header_string(header, sizeof(header));
+	HelperReader header_reader(header_string);
+	uint32_t length;
+	header_reader.getU32(length);
+	
+	if (length == 0 || length > HELPER_MAX_FRAME) {
+		cout << "Error: malformed reply from helper on " << ip_ << endl;
+		
+		stopHelper();
+		return false;
+	}
+	
+	reply.resize(length);
+	
+	if (!readChannelExact(helper_, &reply.at(0), length)) {
+		cout << "Error: lost helper on " << ip_ << endl;
+		
+		stopHelper();
+		return false;
+	}
+	
+	if (reply.at(0) != HELPER_STATUS_OK)
+		return false;
+		
+	reply.erase(0, 1);
+	return true;
+}
+
+bool SSH::helperStat(const vector<string>& paths, vector<HelperStat>& results) {
+	HelperWriter request;
+	request.putU8(HELPER_STAT);
+	request.putU32(paths.size());
+	for_each(paths.begin(), paths.end(), [&request] (const string& path) { request.putString(path); });
+	
+	string reply;
+	
+	if (!helperRequest(request, reply))
+		return false;
+		
+	HelperReader reader(reply);
+	results.clear();
+	
+	for (size_t i = 0; i < paths.size(); i++) {
+		HelperStat result;
+		uint8_t exists;
+		
+		if (!reader.getU8(exists) || !reader.getU32(result.mode_) || !reader.getU64(result.size_) || !reader.getU64(result.mtime_))
+			return false;
+			
+		result.exists_ = exists != 0;
+		results.push_back(result);
+	}
+	
+	return true;
+}
+
+bool SSH::helperHash(const vector<string>& paths, vector<string>& digests) {
+	HelperWriter request;
+	request.putU8(HELPER_HASH);
+	request.putU32(paths.size());
+	for_each(paths.begin(), paths.end(), [&request] (const string& path) { request.putString(path); });
+	
+	string reply;
+	
+	if (!helperRequest(request, reply))
+		return false;
+		
+	HelperReader reader(reply);
+	digests.clear();
+	
+	// Digests use the cksum format so they compare directly with local ones, empty when unreadable
+	for (size_t i = 0; i < paths.size(); i++) {
+		uint8_t ok;
+		uint32_t crc;
+		uint64_t size;
+		
+		if (!reader.getU8(ok) || !reader.getU32(crc) || !reader.getU64(size))
+			return false;
+			
+		digests.push_back(ok ? cksumFinish(crc, size) : "");
+	}
+	
+	return true;
+}
+
+bool SSH::helperExec(const string& command, string& output) {
+	HelperWriter request;
+	request.putU8(HELPER_EXEC);
+	request.putString(command);
+	
+	string reply;
+	uint32_t status;
+	
+	if (!helperRequest(request, reply))
+		return false;
+		
+	HelperReader reader(reply);
+	
+	if (!reader.getU32(status) || !reader.getString(output))
+		return false;
+		
+	exit_status_ = status;
+	return true;
+}
+
+bool SSH::helperRead(const string& path, uint64_t offset, uint32_t length, string& data) {
+	HelperWriter request;
+	request.putU8(HELPER_READ);
+	request.putString(path);
+	request.putU64(offset);
+	request.putU32(length);
+	
+	string reply;
+	
+	if (!helperRequest(request, reply))
+		return false;
+		
+	HelperReader reader(reply);
+	
+	return reader.getString(data);
+}
+
+bool SSH::helperWrite(const string& path, uint64_t offset, const string& data) {
+	HelperWriter request;
+	request.putU8(HELPER_WRITE);
+	request.putString(path);
+	request.putU64(offset);
+	request.putString(data);
+	
+	string reply;
+	
+	return helperRequest(request, reply);
+}
+
+// Progress is made durable every RESUME_CHECKPOINT_SIZE bytes
+static const uint64_t RESUME_CHECKPOINT_SIZE = 8 * 1024 * 1024;
+// Resumable downloads keep SFTP_READS_IN_FLIGHT requests of SFTP_REQUEST_SIZE bytes outstanding
+static const size_t SFTP_REQUEST_SIZE = 32768;
+static const size_t SFTP_READS_IN_FLIGHT = 32;
+
+static void getUploadJournal(const string& ip, const string& filename, const string& remote_path, const struct stat& local, string& journal, string& key) {
+	journal = getJournalPath(ip, "upload " + filename + " " + remote_path);
+	key = "upload " + filename + " " + remote_path + " " + to_string(local.st_size) + " " + to_string(local.st_mtime);
+}
+
+// True when an earlier upload of this very file was interrupted, whatever is at remote_path is
+// then a partial copy of it
+static bool hasUploadJournal(const string& ip, const string& filename, const string& remote_path) {
+	struct stat local;
+	string journal, key;
+	uint64_t offset;
+	
+	if (stat(filename.c_str(), &local) != 0)
+		return false;
+		
+	getUploadJournal(ip, filename, remote_path, local, journal, key);
+	
+	return readJournal(journal, key, offset);
+}
+
+// Uploads stream through an exec channel instead of SFTP, libssh's sftp_write waits for the
+// server's reply on every call while the channel keeps a full window in flight
+bool SSH::transferRemoteResumable(const string& filename, const string& remote_path) {
+	struct stat local;
+	
+	if (stat(filename.c_str(), &local) != 0) {
+		cout << "Warning: could not write file to remote host (" << filename << ")\n";
+		
+		return false;
+	}
+	
+	string journal, key;
+	getUploadJournal(ip_, filename, remote_path, local, journal, key);
+	uint64_t offset = 0;
+	
+	if (readJournal(journal, key, offset) && offset > 0) {
+		string local_digest, remote_digest;
+		
+		// Only what reached the remote file counts, the journal also holds data still in flight
+		if (hashRemotePrefix(remote_path, offset, remote_digest)) {
+			size_t separator = remote_digest.find(' ');
+			
+			if (separator != string::npos)
+				offset = min<uint64_t>(offset, strtoull(remote_digest.c_str() + separator + 1, NULL, 10));
+		}
+		
+		if (remote_digest.empty() || !hashLocalPrefix(filename, offset, local_digest) || local_digest != remote_digest) {
+			cout << "Warning: remote copy of " << remote_path << " does not match, restarting transfer\n";
+			
+			offset = 0;
+		}
+	} else {
+		offset = 0;
+	}
+	
+	ifstream file(filename, ios::binary);
+	file.seekg(offset);
+	
+	if (!file) {
+		cout << "Warning: could not write file to remote host (" << filename << ")\n";
+		
+		return false;
+	}
+	
+	// dd cuts the remote file at the verified offset, cat appends the rest
+	string quoted = shellQuote(remote_path);
+	ssh_channel channel = openExecChannel("umask 077 && dd if=/dev/null of=" + quoted + " bs=1 seek=" + to_string(offset) + " 2>/dev/null && cat >> " + quoted + " && chmod 700 " + quoted);
+	
+	if (channel == NULL)
+		return false;
+		
+	const size_t FILE_BUFFER_SIZE = 16384;
+	char file_buffer[FILE_BUFFER_SIZE];
+	uint64_t left = local.st_size - offset;
+	uint64_t unsaved = 0;
+	bool succeeded = true;
+	
+	while (left > 0) {
+		size_t read_amount = left > FILE_BUFFER_SIZE ? FILE_BUFFER_SIZE : left;
+		file.read(file_buffer, read_amount);
+		
+		if (!file) {
+			cout << "Warning: could not read " << filename << endl;
+			
+			succeeded = false;
+			break;
+		}
+		
+		throttle(read_amount, PRIORITY_BULK);
+		
+		if (ssh_channel_write(channel, file_buffer, read_amount) != (int)read_amount) {
+			cout << "Warning: could not write data to remote file\n";
+			
+			succeeded = false;
+			break;
+		}
+		
+		offset += read_amount;
+		unsaved += read_amount;
+		left -= read_amount;
+		
+		if (unsaved >= RESUME_CHECKPOINT_SIZE) {
+			writeJournal(journal, key, offset);
+			unsaved = 0;
+		}
+	}
+	
+	ssh_channel_send_eof(channel);
+	
+	string errors;
+	
+	while (true) {
+		int bytes_received = ssh_channel_read(channel, file_buffer, FILE_BUFFER_SIZE, 1);
+		
+		if (bytes_received <= 0)
+			break;
+			
+		errors.append(file_buffer, bytes_received);
+	}
+	
+	int status = ssh_channel_get_exit_status(channel);
+	
+	ssh_channel_close(channel);
+	ssh_channel_free(channel);
+	
+	if (succeeded && status != 0) {
+		cout << "Warning: could not write remote file " << remote_path << " on " << ip_ << " " << errors << endl;
+		
+		succeeded = false;
+	}
+	
+	// Data handed to the channel counts as progress, resuming trims it to what actually arrived
+	if (succeeded)
+		remove(journal.c_str());
+	else
+		writeJournal(journal, key, offset);
+		
+	return succeeded;
+}
+
+bool SSH::transferLocalResumable(const string& from, const string& local_path) {
+	sftp_session sftp = openSftp();
+	
+	if (sftp == NULL)
+		return false;
+		
+	sftp_attributes attributes = sftp_stat(sftp, from.c_str());
+	
+	if (attributes == NULL || attributes->type != SSH_FILEXFER_TYPE_REGULAR) {
+		cout << "Warning: resumable transfers need a regular remote file (" << from << ")\n";
+		
+		if (attributes != NULL)
+			sftp_attributes_free(attributes);
+			
+		sftp_free(sftp);
+		return false;
+	}
+	
+	uint64_t size = attributes->size;
+	sftp_attributes_free(attributes);
+	
+	string journal = getJournalPath(ip_, "download " + from + " " + local_path);
+	string key = "download " + from + " " + local_path + " " + to_string(size);
+	uint64_t offset = 0;
+	
+	if (readJournal(journal, key, offset) && offset > 0) {
+		string local_digest, remote_digest;
+		
+		if (!hashLocalPrefix(local_path, offset, local_digest) || !hashRemotePrefix(from, offset, remote_digest) || local_digest != remote_digest) {
+			cout << "Warning: local copy of " << from << " does not match, restarting transfer\n";
+			
+			offset = 0;
+		}
+	} else {
+		offset = 0;
+	}
+	
+	sftp_file remote = sftp_open(sftp, from.c_str(), O_RDONLY, 0);
+	
+	if (remote == NULL || sftp_seek64(remote, offset) < 0) {
+		cout << "Warning: could not open remote file " << from << " for reading\n";
+		
+		if (remote != NULL)
+			sftp_close(remote);
+			
+		sftp_free(sftp);
+		return false;
+	}
+	
+	int fd = open(local_path.c_str(), O_WRONLY | O_CREAT | (offset == 0 ? O_TRUNC : 0), 0644);
+	
+	if (fd < 0 || lseek(fd, offset, SEEK_SET) < 0) {
+		cout << "Warning: could not open file for writing local SFTP\n";
+		
+		if (fd >= 0)
+			close(fd);
+			
+		sftp_close(remote);
+		sftp_free(sftp);
+		return false;
+	}
+	
+	// Keep several reads in flight, sftp_read alone waits a full round trip per request
+	struct PendingRead {
+		int id_;
+		uint32_t length_;
+	};
+	
+	deque<PendingRead> pending;
+	uint64_t requested = offset;
+	char file_buffer[SFTP_REQUEST_SIZE];
+	uint64_t unsaved = 0;
+	bool succeeded = true;
+	
+	while (offset < size) {
+		while (pending.size() < SFTP_READS_IN_FLIGHT && requested < size) {
+			uint32_t length = min<uint64_t>(SFTP_REQUEST_SIZE, size - requested);
+			int id = sftp_async_read_begin(remote, length);
+			
+			if (id < 0)
+				break;
+				
+			pending.push_back({ id, length });
+			requested += length;
+		}
+		
+		if (pending.empty()) {
+			cout << "Error reading SFTP\n";
+			
+			succeeded = false;
+			break;
+		}
+		
+		PendingRead request = pending.front();
+		pending.pop_front();
+		
+		// A short read means the file changed under us, the size is known up front
+		int read = sftp_async_read(remote, file_buffer, request.length_, request.id_);
+		
+		if (read != (int)request.length_) {
+			cout << "Error reading SFTP\n";
+			
+			succeeded = false;
+			break;
+		}
+		
+		for (ssize_t wrote = 0; wrote < read; ) {
+			ssize_t amount = write(fd, file_buffer + wrote, read - wrote);
+			
+			if (amount < 0) {
+				cout << "Warning: could not write " << local_path << endl;
+				
+				succeeded = false;
+				break;
+			}
+			
+			wrote += amount;
+		}
+		
+		if (!succeeded)
+			break;
+			
+		offset += read;
+		unsaved += read;
+		
+		// Only record progress which has actually reached the disk
+		if (unsaved >= RESUME_CHECKPOINT_SIZE && fsync(fd) == 0) {
+			writeJournal(journal, key, offset);
+			unsaved = 0;
+		}
+	}
+	
+	sftp_close(remote);
+	sftp_free(sftp);
+	
+	if (succeeded) {
+		// Drop anything left over from an older, longer copy
+		if (ftruncate(fd, size) != 0)
+			cout << "Warning: could not truncate " << local_path << endl;
+			
+		close(fd);
+		remove(journal.c_str());
+	} else {
+		if (fsync(fd) == 0)
+			writeJournal(journal, key, offset);
+			
+		close(fd);
+	}
+	
+	return succeeded;
+}
+
+// Uploads through tee so the remote cksum is computed from the same stream that is written to
+// disk, anything tee prints on stderr (e.g. ENOSPC) marks the transfer as failed
+bool SSH::transferRemoteVerified(const string& filename, const string& remote_path) {
+	ifstream file(filename, ios::binary);
+	
+	if (!file.is_open()) {
+		cout << "Warning: could not write file to remote host (" << filename << ")\n";
+		
+		return false;
+	}
+	
+	string quoted = shellQuote(remote_path);
+	ssh_channel channel = openExecChannel("umask 077 && tee " + quoted + " | cksum && chmod 700 " + quoted);
+	
+	if (channel == NULL)
+		return false;
+		
+	const size_t FILE_BUFFER_SIZE = 16384;
+	char file_buffer[FILE_BUFFER_SIZE];
+	uint32_t crc = 0;
+	uint64_t size = 0;
+	bool succeeded = true;
+	
+	while (file) {
+		file.read(file_buffer, FILE_BUFFER_SIZE);
+		size_t read_amount = file.gcount();
+		
+		if (read_amount == 0)
+			break;
+			
+		crc = cksumUpdate(crc, file_buffer, read_amount);
+		size += read_amount;
+		
+		throttle(read_amount, PRIORITY_BULK);
+		
+		if (ssh_channel_write(channel, file_buffer, read_amount) != (int)read_amount) {
+			cout << "Warning: could not write data to remote file\n";
+			
+			succeeded = false;
+			break;
+		}
+	}
+	
+	if (file.bad()) {
+		cout << "Warning: could not read " << filename << endl;
+		
+		succeeded = false;
+	}
+	
+	ssh_channel_send_eof(channel);
+	
+	string streams[2];
+	
+	for (int stream = 0; stream <= 1; stream++) {
+		while (true) {
+			int bytes_received = ssh_channel_read(channel, file_buffer, FILE_BUFFER_SIZE, stream);
+			
+			if (bytes_received <= 0)
+				break;
+				
+			streams[stream].append(file_buffer, bytes_received);
+		}
+	}
+	
+	int status = ssh_channel_get_exit_status(channel);
+	
+	ssh_channel_close(channel);
+	ssh_channel_free(channel);
+	
+	if (!succeeded)
+		return false;
+		
+	trimTrailingWhitespace(streams[0]);
+		
+	if (status != 0 || !streams[1].empty() || streams[0] != cksumFinish(crc, size)) {
+		cout << "Error: checksum mismatch for " << remote_path << " on " << ip_ << " " << streams[1] << endl;
+		
+		return false;
+	}
+	
+	return true;
+}
+
+// Downloads through tee as well, the file arrives on stdout and the remote cksum of the very same
+// bytes on stderr
+bool SSH::transferLocalVerified(const string& from, const string& local_path) {
+	ofstream file(local_path, ios::binary);
+	
+	if (!file.is_open()) {
+		cout << "Warning: could not open file for writing local SCP\n";
+		
+		return false;
+	}
+	
+	string quoted = shellQuote(from);
+	// The pipeline's status is cksum's, so make sure tee can open the file before starting it
+	ssh_channel channel = openExecChannel("test -f " + quoted + " && test -r " + quoted + " || { echo 'not a readable file' >&2; exit 1; }; { tee /dev/fd/3 < " + quoted + " | cksum >&2; } 3>&1");
+	
+	if (channel == NULL)
+		return false;
+		
+	const size_t FILE_BUFFER_SIZE = 16384;
+	char file_buffer[FILE_BUFFER_SIZE];
+	uint32_t crc = 0;
+	uint64_t size = 0;
+	
+	while (true) {
+		int bytes_received = ssh_channel_read(channel, file_buffer, FILE_BUFFER_SIZE, 0);
+		
+		if (bytes_received <= 0)
+			break;
+			
+		crc = cksumUpdate(crc, file_buffer, bytes_received);
+		size += bytes_received;
+		file.write(file_buffer, bytes_received);
+	}
+	
+	string digest;
+	
+	while (true) {
+		int bytes_received = ssh_channel_read(channel, file_buffer, FILE_BUFFER_SIZE, 1);
 		
-		return 0;
+		if (bytes_received <= 0)
+			break;
+			
+		digest.append(file_buffer, bytes_received);
 	}
 	
-	size_t size = file.tellg();
+	int status = ssh_channel_get_exit_status(channel);
+	
+	ssh_channel_send_eof(channel);
+	ssh_channel_close(channel);
+	ssh_channel_free(channel);
+	
 	file.close();
 	
-	return size;
+	trimTrailingWhitespace(digest);
+	
+	if (status != 0) {
+		cout << "Error: could not read " << from << " on " << ip_ << " (" << digest << ")\n";
+		
+		return false;
+	}
+	
+	if (!file) {
+		cout << "Warning: could not write " << local_path << endl;
+		
+		return false;
+	}
+		
+	if (digest != cksumFinish(crc, size)) {
+		cout << "Error: checksum mismatch for " << from << " from " << ip_ << " " << digest << endl;
+		
+		return false;
+	}
+	
+	return true;
 }
 
-bool SSH::fileExists(const string& path, const string& filename) {
-	sftp_session sftp = sftp_new(session_);
+// Resumable transfers are written in pieces, so with verification on both copies are hashed
+// in full once they are complete
+bool SSH::verifyCopy(const string& local_path, const string& remote_path) {
+	struct stat local;
+	string local_digest, remote_digest;
 	
-	if (sftp == NULL) {
-		cout << "ERROR: Allocating SFTP session: " << ssh_get_error(session_) << endl;
+	if (stat(local_path.c_str(), &local) != 0 || !hashLocalPrefix(local_path, local.st_size, local_digest)) {
+		cout << "Warning: could not read " << local_path << endl;
 		
 		return false;
 	}
 	
-	if (sftp_init(sftp) != SSH_OK) {
-		cout << "ERROR: Initializing SFTP session: " << sftp_get_error(sftp) << endl;
+	if (!captureCommand("cksum < " + shellQuote(remote_path), remote_digest)) {
+		cout << "Error: could not hash " << remote_path << " on " << ip_ << endl;
 		
-		sftp_free(sftp);
 		return false;
 	}
 	
-	sftp_file file = sftp_open(sftp, (path + filename).c_str(), O_RDONLY, 0);
-	bool result = false;
+	trimTrailingWhitespace(remote_digest);
 	
-	if (file != NULL) {
-		sftp_close(file);
-		result = true;
+	if (local_digest != remote_digest) {
+		cout << "Error: checksum mismatch for " << remote_path << " on " << ip_ << endl;
+		
+		return false;
 	}
 	
-	sftp_free(sftp);
-	return result;
+	return true;
 }
 
-bool SSH::transferRemote(const string& from, const string& to, bool overwrite) {
+bool SSH::transferRemote(const string& from, const string& to, bool overwrite, bool resumable, bool verify) {
 	if (!connected_) {
 		cout << "Warning: can't read from SCP without an active SSH connection\n";
 		
 		return false;
 	}
 	
+	vector<string> files = splitString(from, ' ');
+	vector<bool> existing(files.size(), false);
+	
+	// Check which files already exist, in one batch when the helper is running
+	if (!overwrite) {
+		vector<string> remote_files;
+		for_each(files.begin(), files.end(), [&remote_files] (const string& filename) { remote_files.push_back(getFilenameFromPath(filename)); });
+		
+		existing = filesExist(to, remote_files);
+	}
+	
+	if (resumable || verify) {
+		for (size_t i = 0; i < files.size(); i++) {
+			const string& filename = files.at(i);
+			string remote_file = getFilenameFromPath(filename);
+			
+			string remote_path = (!to.empty() && to.back() == '/' ? to : to + "/") + remote_file;
+			
+			// A file left behind by an interrupted upload is resumed, not skipped as done
+			if (existing.at(i) && !(resumable && hasUploadJournal(ip_, filename, remote_path)))
+				continue;
+				
+			bool result = resumable ? transferRemoteResumable(filename, remote_path) : transferRemoteVerified(filename, remote_path);
+			
+			if (result && resumable && verify)
+				result = verifyCopy(filename, remote_path);
+				
+			if (!result)
+				return false;
+		}
+		
+		return true;
+	}
+	
 	ssh_scp scp = ssh_scp_new(session_, SSH_SCP_WRITE | SSH_SCP_RECURSIVE, to.c_str());
 	
 	if (scp == NULL) {
@@ -136,17 +1146,13 @@ bool SSH::transferRemote(const string& from, const string& to, bool overwrite) {
 		return false;
 	}
 
-	vector<string> files = splitString(from, ' ');
-	
-	for (auto& filename : files) {
+	for (size_t i = 0; i < files.size(); i++) {
+		const string& filename = files.at(i);
 		string remote_file = getFilenameFromPath(filename);
 		
-		// Check if the file already exists
-		if (!overwrite) {
-			if (fileExists(to, remote_file))
-				continue;
-		}
-		
+		if (existing.at(i))
+			continue;
+			
 		ifstream file(filename);
 		
 		if (!file.is_open()) {
@@ -180,6 +1186,8 @@ bool SSH::transferRemote(const string& from, const string& to, bool overwrite) {
 			if (!file)
 				ERROR("error reading file\n");
 				
+			throttle(read_amount, PRIORITY_BULK);
+			
 			int wrote = ssh_scp_write(scp, file_buffer, read_amount);
 			
 			if (wrote != SSH_OK) {
@@ -210,12 +1218,32 @@ bool SSH::transferRemote(const string& from, const string& to, bool overwrite) {
 	return true;
 }
 
-bool SSH::transferLocal(const string& from, const string& to, const string& custom_filename) {
+bool SSH::transferLocal(const string& from, const string& to, const string& custom_filename, bool resumable, bool verify) {
 	if (!connected_) {
 		cout << "Warning: can't read from SCP without an active SSH connection\n";
 		
 		return false;
 	}
+	
+	string ignored;
+	
+	// Both modes handle single files only, directories keep the recursive SCP behaviour
+	if ((resumable || verify) && captureCommand("test -d " + shellQuote(from), ignored)) {
+		cout << "Warning: " << from << " is a directory, transferring it without resume or verification\n";
+		
+		resumable = false;
+		verify = false;
+	}
+	
+	if (resumable || verify) {
+		string filename = getFilenameFromPath(from);
+		string local_path = custom_filename == "" ? (to + "/" + (filename == "" ? from : filename)) : custom_filename;
+		
+		if (!resumable)
+			return transferLocalVerified(from, local_path);
+			
+		return transferLocalResumable(from, local_path) && (!verify || verifyCopy(local_path, from));
+	}
 		
 	ssh_scp scp = ssh_scp_new(session_, SSH_SCP_READ | SSH_SCP_RECURSIVE, from.c_str());
 	
@@ -333,17 +1361,35 @@ bool SSH::connect() {
 	ssh_options_set(session_, SSH_OPTIONS_USER, real_user.c_str());
 	ssh_options_set(session_, SSH_OPTIONS_STRICTHOSTKEYCHECK, 0 /* Do not ask for fingerprint approval */);
 	
+	if (bastion_ != nullptr) {
+		// Dial through a direct-tcpip channel on the bastion instead of connecting directly
+		socket_t tunnel = bastion_->openTunnel(ip_, 22);
+		
+		if (tunnel < 0) {
+			cout << "Error: could not tunnel to " << ip_ << " through bastion\n";
+			
+			ssh_free(session_);
+			session_ = NULL;
+			return false;
+		}
+		
+		ssh_options_set(session_, SSH_OPTIONS_FD, &tunnel);
+	}
+	
 	if (ssh_connect(session_) != SSH_OK) {
 		cout << "Error: could not connect to " << ip_ << " code: " << ssh_get_error(session_) << endl;
 		
 		ssh_free(session_);
+		session_ = NULL;
 		return false;
 	}
 	
 	if (ssh_userauth_password(session_, NULL, pass_.c_str()) != SSH_AUTH_SUCCESS) {
 		cout << "Error: wrong password for " << ip_ << endl;
 		
-		disconnect();
+		ssh_disconnect(session_);
+		ssh_free(session_);
+		session_ = NULL;
 		return false;
 	}
 	
@@ -360,59 +1406,339 @@ static string getTimestamp() {
 	return ctime(&current_time);
 }
 
-bool SSH::command(const string& command, bool output_file, bool output_vector) {
-	if (output_file && output_vector) {
-		cout << "Warning: don't have both vector and file style outputs enabled, there will be problems.\n";
+static ofstream* openOutputFile(const string& ip) {
+	string filename = "stdout_" + ip;
+	ofstream* file = new ofstream(filename, ios_base::app);
+	
+	if (!file->is_open()) {
+		delete file;
+		
+		return nullptr;
+	}
+	
+	string current_time = getTimestamp();
+	
+	file->write("[", 1);
+	file->write(current_time.c_str(), current_time.length() - 1);
+	file->write("]\n", 2);
+	
+	return file;
+}
+
+bool SSH::openShell() {
+	shell_ = ssh_channel_new(session_);
+	
+	if (shell_ == NULL) {
+		cout << "Error: could not create shell channel\n";
 		
 		return false;
 	}
 	
-	if (!connected_) {
-		cout << "Error: could not execute command, we're not connected\n";
+	if (ssh_channel_open_session(shell_) != SSH_OK) {
+		cout << "Error: could not open shell channel\n";
+		
+		ssh_channel_free(shell_);
+		shell_ = NULL;
+		return false;
+	}
+	
+	if (ssh_channel_request_shell(shell_) != SSH_OK) {
+		cout << "Error: could not request shell\n";
+		
+		closeShell();
+		return false;
+	}
+	
+	// Merge stderr into stdout so output stays ordered and can't stall the channel
+	const string setup = "exec 2>&1\n";
+	
+	if (ssh_channel_write(shell_, setup.c_str(), setup.length()) != (int)setup.length()) {
+		cout << "Error: could not set up shell on " << ip_ << endl;
+		
+		closeShell();
+		return false;
+	}
+	
+	return true;
+}
+
+void SSH::closeShell() {
+	if (shell_ == NULL)
+		return;
+		
+	ssh_channel_send_eof(shell_);
+	ssh_channel_close(shell_);
+	ssh_channel_free(shell_);
+	shell_ = NULL;
+}
+
+// A shell that stays silent this long is considered wedged and closed, the next command opens a
+// fresh one
+static const int SHELL_READ_TIMEOUT_MS = 10 * 60 * 1000;
+
+bool SSH::shellCommand(const string& command, string& output) {
+	if (shell_ == NULL && !openShell())
+		return false;
+		
+	// Unique sentinel which marks the end of this command's output, followed by the exit code
+	string sentinel = "__nessh_" + to_string(chrono::steady_clock::now().time_since_epoch().count()) + "_" + to_string(shell_commands_++) + "__";
+	
+	// Passed quoted to eval so a syntax error fails this command alone instead of swallowing the
+	// sentinel, "command" stops that error from exiting the shell. Stdin is kept away from it,
+	// otherwise it could eat the following commands
+	string framed = "command eval " + shellQuote(command) + " < /dev/null; printf '\\n" + sentinel + " %d\\n' $?\n";
+	
+	throttle(framed.length(), PRIORITY_INTERACTIVE);
+	
+	if (ssh_channel_write(shell_, framed.c_str(), framed.length()) != (int)framed.length()) {
+		cout << "Error: could not write command to shell on " << ip_ << endl;
 		
+		closeShell();
 		return false;
 	}
 	
+	string marker = "\n" + sentinel + " ";
+	string received;
+	size_t searched = 0;
+	char buffer[4096];
+	
+	while (true) {
+		size_t position = received.find(marker, searched);
+		
+		if (position != string::npos) {
+			size_t line_end = received.find('\n', position + marker.length());
+			
+			if (line_end != string::npos) {
+				exit_status_ = atoi(received.c_str() + position + marker.length());
+				output = received.substr(0, position);
+				
+				return true;
+			}
+		} else if (received.length() >= marker.length()) {
+			searched = received.length() - marker.length() + 1;
+		}
+		
+		int bytes_received = ssh_channel_read_timeout(shell_, buffer, sizeof(buffer), 0, SHELL_READ_TIMEOUT_MS);
+		
+		if (bytes_received == 0 && !ssh_channel_is_eof(shell_)) {
+			cout << "Error: no output from shell on " << ip_ << " for " << SHELL_READ_TIMEOUT_MS / 1000 << " seconds, closing it\n";
+			
+			closeShell();
+			return false;
+		}
+		
+		if (bytes_received <= 0) {
+			cout << "Error: shell channel closed on " << ip_ << endl;
+			
+			closeShell();
+			return false;
+		}
+		
+		received.append(buffer, bytes_received);
+	}
+}
+
+ssh_channel SSH::openExecChannel(const string& command) {
 	ssh_channel channel = ssh_channel_new(session_);
 	
 	if (channel == NULL) {
 		cout << "Error: could not create channel\n";
 		
-		return false;
+		return NULL;
 	}
 	
 	if (ssh_channel_open_session(channel) != SSH_OK) {
 		cout << "Error: could not open channel\n";
 		
 		ssh_channel_free(channel);
-		return false;
+		return NULL;
 	}
 	
+	throttle(command.length(), PRIORITY_INTERACTIVE);
+	
 	if (ssh_channel_request_exec(channel, command.c_str()) != SSH_OK) {
 		cout << "Error: could not execute command\n";
 		
 		ssh_channel_close(channel);
 		ssh_channel_free(channel);
+		return NULL;
+	}
+	
+	return channel;
+}
+
+bool SSH::commandInput(const string& command, const function<bool(shared_ptr<const string>&)>& next_chunk, bool output_file, bool output_vector) {
+	if (output_file && output_vector) {
+		cout << "Warning: don't have both vector and file style outputs enabled, there will be problems.\n";
+		
+		return false;
+	}
+	
+	if (!connected_) {
+		cout << "Error: could not execute command, we're not connected\n";
+		
 		return false;
 	}
 	
+	ssh_channel channel = openExecChannel(command);
+	
+	if (channel == NULL)
+		return false;
+		
 	ofstream* file = nullptr;
 	
-	if (output_file) {
-		string filename = "stdout_" + ip_;
-		file = new ofstream(filename, ios_base::app);
+	if (output_file)
+		file = openOutputFile(ip_);
+	else if (output_vector)
+		output_.clear();
+		
+	char buffer[4096];
+	
+	// Reads whatever output is available, waiting up to timeout ms for stdout if asked to
+	auto drain = [&] (int timeout) -> bool {
+		for (int stream = 0; stream <= 1; stream++) {
+			while (true) {
+				int bytes_received;
+				
+				if (timeout > 0 && stream == 0)
+					bytes_received = ssh_channel_read_timeout(channel, buffer, sizeof(buffer), stream, timeout);
+				else
+					bytes_received = ssh_channel_read_nonblocking(channel, buffer, sizeof(buffer), stream);
+					
+				timeout = 0;
+				
+				if (bytes_received == SSH_ERROR)
+					return false;
+					
+				if (bytes_received <= 0)
+					break;
+					
+				if (file != nullptr)
+					file->write(buffer, bytes_received);
+				else if (output_vector)
+					output_.push_back(string(buffer, bytes_received));
+			}
+		}
+		
+		return true;
+	};
+	
+	bool succeeded = true;
+	shared_ptr<const string> chunk;
+	
+	while (succeeded && next_chunk(chunk)) {
+		size_t written = 0;
 		
-		if (!file->is_open()) {
-			delete file;
+		while (written < chunk->length()) {
+			// A remote blocked on a full stdout stops reading its stdin, so keep draining it
+			if (!drain(0) || ssh_channel_is_eof(channel)) {
+				cout << "Warning: remote command stopped reading input on " << ip_ << endl;
+				
+				succeeded = false;
+				break;
+			}
 			
-			goto end;
+			size_t window = ssh_channel_window_size(channel);
+			
+			// Remote isn't keeping up, wait for a window adjust instead of buffering locally
+			if (window == 0) {
+				drain(10);
+				
+				continue;
+			}
+			
+			size_t amount = min(window, chunk->length() - written);
+			throttle(amount, PRIORITY_BULK);
+			
+			int wrote = ssh_channel_write(channel, chunk->data() + written, amount);
+			
+			if (wrote == SSH_ERROR) {
+				cout << "Warning: could not write input to remote command on " << ip_ << endl;
+				
+				succeeded = false;
+				break;
+			}
+			
+			written += wrote;
+		}
+	}
+	
+	ssh_channel_send_eof(channel);
+	
+	for (int stream = 0; stream <= 1; stream++) {
+		do {
+			int bytes_received = ssh_channel_read(channel, buffer, sizeof(buffer), stream);
+			
+			if (bytes_received <= 0)
+				break;
+				
+			if (file != nullptr)
+				file->write(buffer, bytes_received);
+			else if (output_vector)
+				output_.push_back(string(buffer, bytes_received));
+		} while (true);
+	}
+	
+	if (file != nullptr) {
+		file->close();
+		delete file;
+	}
+	
+	exit_status_ = ssh_channel_get_exit_status(channel);
+	
+	ssh_channel_close(channel);
+	ssh_channel_free(channel);
+	
+	return succeeded;
+}
+
+bool SSH::command(const string& command, bool output_file, bool output_vector, bool persistent_shell) {
+	if (output_file && output_vector) {
+		cout << "Warning: don't have both vector and file style outputs enabled, there will be problems.\n";
+		
+		return false;
+	}
+	
+	if (!connected_) {
+		cout << "Error: could not execute command, we're not connected\n";
+		
+		return false;
+	}
+	
+	if (persistent_shell) {
+		string shell_output;
+		
+		if (!shellCommand(command, shell_output))
+			return false;
+			
+		if (output_file) {
+			ofstream* file = openOutputFile(ip_);
+			
+			if (file != nullptr) {
+				file->write(shell_output.c_str(), shell_output.length());
+				file->close();
+				delete file;
+			}
+		} else if (output_vector) {
+			output_.clear();
+			output_.push_back(shell_output);
 		}
 		
-		string current_time = getTimestamp();
+		return true;
+	}
+	
+	ssh_channel channel = openExecChannel(command);
+	
+	if (channel == NULL)
+		return false;
+		
+	ofstream* file = nullptr;
+	
+	if (output_file) {
+		file = openOutputFile(ip_);
 		
-		file->write("[", 1);
-		file->write(current_time.c_str(), current_time.length() - 1);
-		file->write("]\n", 2);
+		if (file == nullptr)
+			goto end;
 	} else if (output_vector) {
 		output_.clear();
 	}
@@ -438,6 +1764,8 @@ bool SSH::command(const string& command, bool output_file, bool output_vector) {
 		delete file;
 	}
 	
+	exit_status_ = ssh_channel_get_exit_status(channel);
+	
 end:
 	ssh_channel_send_eof(channel);
 	ssh_channel_close(channel);
@@ -446,6 +1774,18 @@ end:
 	return true;
 }
 
+const string& SSH::getIP() const {
+	return ip_;
+}
+
+const string& SSH::getHelperPath() const {
+	return helper_path_;
+}
+
+bool SSH::isConnected() const {
+	return connected_;
+}
+
 bool SSH::operator==(const string& ip) {
 	return ip == ip_;
 }
\ No newline at end of file
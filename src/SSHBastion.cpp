@@ -0,0 +1,355 @@
+#include "SSHBastion.h"
+
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+
+using namespace std;
+
+SSHBastion::SSHBastion(const string& ip, const string& user, const string& pass) :
+	ip_(ip), user_(user), pass_(pass) {
+	connected_ = false;
+	running_ = false;
+}
+
+SSHBastion::~SSHBastion() {
+	disconnect();
+}
+
+bool SSHBastion::connect() {
+	session_ = ssh_new();
+	
+	if (session_ == NULL) {
+		cout << "Error: could not create bastion SSH session\n";
+		
+		return false;
+	}
+	
+	string real_user = user_.length() == 0 ? "root" : user_;
+	
+	ssh_options_set(session_, SSH_OPTIONS_HOST, ip_.c_str());
+	ssh_options_set(session_, SSH_OPTIONS_USER, real_user.c_str());
+	ssh_options_set(session_, SSH_OPTIONS_STRICTHOSTKEYCHECK, 0 /* Do not ask for fingerprint approval */);
+	
+	if (ssh_connect(session_) != SSH_OK) {
+		cout << "Error: could not connect to bastion " << ip_ << " code: " << ssh_get_error(session_) << endl;
+		
+		ssh_free(session_);
+		return false;
+	}
+	
+	if (ssh_userauth_password(session_, NULL, pass_.c_str()) != SSH_AUTH_SUCCESS) {
+		cout << "Error: wrong password for bastion " << ip_ << endl;
+		
+		ssh_disconnect(session_);
+		ssh_free(session_);
+		return false;
+	}
+	
+	// Nothing on this session may block the pump, tunnels are opened without waiting for the reply
+	ssh_set_blocking(session_, 0);
+	
+	// Lets the pump process incoming packets once, dispatching them to every tunnel's callbacks
+	event_ = ssh_event_new();
+	
+	if (event_ == NULL || ssh_event_add_session(event_, session_) != SSH_OK) {
+		cout << "Error: could not create event loop for bastion " << ip_ << endl;
+		
+		if (event_ != NULL)
+			ssh_event_free(event_);
+		
+		ssh_disconnect(session_);
+		ssh_free(session_);
+		return false;
+	}
+	
+	connected_ = true;
+	running_ = true;
+	pump_thread_ = thread(&SSHBastion::pump, this);
+	
+	return true;
+}
+
+void SSHBastion::disconnect() {
+	if (!connected_)
+		return;
+	
+	running_ = false;
+	pump_thread_.join();
+	
+	for_each(tunnels_.begin(), tunnels_.end(), [this] (Tunnel& tunnel) { closeTunnel(tunnel); });
+	tunnels_.clear();
+	
+	ssh_event_remove_session(event_, session_);
+	ssh_event_free(event_);
+	ssh_disconnect(session_);
+	ssh_free(session_);
+	connected_ = false;
+}
+
+size_t SSHBastion::getTunnelCount() {
+	lock_guard<mutex> guard(mutex_);
+	
+	return tunnels_.size();
+}
+
+bool SSHBastion::isAlive() {
+	return connected_ && running_;
+}
+
+int SSHBastion::openTunnel(const string& host, int port) {
+	if (!isAlive()) {
+		cout << "Error: can't open tunnel to " << host << " without an active bastion connection to " << ip_ << endl;
+		
+		return -1;
+	}
+	
+	int sockets[2];
+	
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+		cout << "Error: could not create socket pair for tunnel to " << host << endl;
+		
+		return -1;
+	}
+	
+	unique_lock<mutex> lock(mutex_);
+	ssh_channel channel = ssh_channel_new(session_);
+	
+	if (channel == NULL) {
+		cout << "Error: could not create tunnel channel\n";
+		
+		close(sockets[0]);
+		close(sockets[1]);
+		return -1;
+	}
+	
+	tunnels_.push_back(Tunnel());
+	auto iterator = prev(tunnels_.end());
+	Tunnel& tunnel = *iterator;
+	tunnel.channel_ = channel;
+	tunnel.socket_ = sockets[0];
+	// Anything that arrived before the callbacks were set is still buffered in the channel
+	tunnel.backlogged_ = true;
+	tunnel.remote_eof_ = false;
+	tunnel.closed_ = false;
+	tunnel.opening_ = true;
+	tunnel.failed_ = false;
+	tunnel.host_ = host;
+	tunnel.port_ = port;
+	
+	// Sends the request, the reply takes a round trip which the pump waits out for us while it
+	// keeps the other tunnels moving
+	continueOpen(tunnel);
+	opened_.wait(lock, [this, &tunnel] { return !tunnel.opening_ || !running_; });
+	
+	if (tunnel.opening_ || tunnel.failed_) {
+		cout << "Error: bastion " << ip_ << " could not open tunnel to " << host << " (" << ssh_get_error(session_) << ")\n";
+		
+		ssh_channel_free(channel);
+		close(sockets[0]);
+		close(sockets[1]);
+		tunnels_.erase(iterator);
+		return -1;
+	}
+	
+	memset(&tunnel.callbacks_, 0, sizeof(tunnel.callbacks_));
+	ssh_callbacks_init(&tunnel.callbacks_);
+	tunnel.callbacks_.userdata = &tunnel;
+	tunnel.callbacks_.channel_data_function = &SSHBastion::onChannelData;
+	tunnel.callbacks_.channel_eof_function = &SSHBastion::onChannelEof;
+	tunnel.callbacks_.channel_close_function = &SSHBastion::onChannelEof;
+	ssh_set_channel_callbacks(channel, &tunnel.callbacks_);
+	
+	// The other end is handed to the target session, which owns it from here on
+	return sockets[1];
+}
+
+// Called again until the bastion answered, with the session non-blocking libssh returns SSH_AGAIN
+// meanwhile
+void SSHBastion::continueOpen(Tunnel& tunnel) {
+	int result = ssh_channel_open_forward(tunnel.channel_, tunnel.host_.c_str(), tunnel.port_, "127.0.0.1", 22);
+	
+	if (result == SSH_AGAIN)
+		return;
+		
+	tunnel.opening_ = false;
+	tunnel.failed_ = result != SSH_OK;
+	opened_.notify_all();
+}
+
+void SSHBastion::closeTunnel(Tunnel& tunnel) {
+	ssh_channel_send_eof(tunnel.channel_);
+	ssh_channel_close(tunnel.channel_);
+	ssh_channel_free(tunnel.channel_);
+	close(tunnel.socket_);
+}
+
+// Don't let one slow local reader hold more than this in memory, the rest stays in the channel
+// where it also stops the window from growing
+static const size_t TUNNEL_BACKLOG_SIZE = 262144;
+
+int SSHBastion::onChannelData(ssh_session, ssh_channel, void* data, uint32_t length, int is_stderr, void* userdata) {
+	Tunnel& tunnel = *static_cast<Tunnel*>(userdata);
+	
+	if (is_stderr)
+		return length;
+	
+	if (tunnel.to_socket_.length() >= TUNNEL_BACKLOG_SIZE) {
+		tunnel.backlogged_ = true;
+		
+		return 0;
+	}
+	
+	tunnel.to_socket_.append(static_cast<const char*>(data), length);
+	
+	return length;
+}
+
+void SSHBastion::onChannelEof(ssh_session, ssh_channel, void* userdata) {
+	static_cast<Tunnel*>(userdata)->remote_eof_ = true;
+}
+
+// Moves data between every tunnel's local socket and its channel, libssh sessions are not
+// thread safe so all channel I/O on the bastion session happens here under mutex_. Only the
+// sockets poll() reports and the tunnels with queued data are touched, incoming channel data
+// arrives through the callbacks when the session socket is readable
+void SSHBastion::pump() {
+	const size_t BUFFER_SIZE = 16384;
+	char buffer[BUFFER_SIZE];
+	vector<pollfd> descriptors;
+	vector<Tunnel*> polled;
+	
+	while (running_) {
+		int timeout = 10;
+		
+		{
+			lock_guard<mutex> guard(mutex_);
+			
+			descriptors.clear();
+			polled.clear();
+			descriptors.push_back({ ssh_get_fd(session_), POLLIN, 0 });
+			
+			for (auto& tunnel : tunnels_) {
+				// Still owned by openTunnel()
+				if (tunnel.opening_ || tunnel.failed_)
+					continue;
+					
+				short events = 0;
+				
+				if (tunnel.to_channel_.empty())
+					events |= POLLIN;
+				
+				if (!tunnel.to_socket_.empty())
+					events |= POLLOUT;
+				
+				descriptors.push_back({ tunnel.socket_, events, 0 });
+				polled.push_back(&tunnel);
+				
+				// Work that doesn't depend on either socket, don't sleep on it
+				bool can_write = !tunnel.to_channel_.empty() && ssh_channel_window_size(tunnel.channel_) > 0;
+				bool can_drain = tunnel.backlogged_ && tunnel.to_socket_.empty();
+				bool can_close = tunnel.remote_eof_ && tunnel.to_socket_.empty();
+				
+				if (can_write || can_drain || can_close)
+					timeout = 0;
+			}
+		}
+		
+		if (poll(descriptors.data(), descriptors.size(), timeout) < 0 && errno != EINTR)
+			break;
+		
+		lock_guard<mutex> guard(mutex_);
+		
+		// Dispatches whatever arrived to the channel callbacks, window adjustments included
+		if (descriptors.front().revents != 0 && ssh_event_dopoll(event_, 0) == SSH_ERROR) {
+			cout << "Error: lost connection to bastion " << ip_ << " (" << ssh_get_error(session_) << ")\n";
+			
+			for (auto& tunnel : tunnels_) {
+				if (tunnel.opening_)
+					tunnel.failed_ = true;
+				else
+					tunnel.closed_ = true;
+			}
+			
+			running_ = false;
+			opened_.notify_all();
+		}
+		
+		// Only a handful are waiting for their reply at any time
+		for (auto& tunnel : tunnels_)
+			if (tunnel.opening_ && running_)
+				continueOpen(tunnel);
+				
+		
+		// Tunnels opened since the poll are picked up on the next pass
+		for (size_t i = 0; i < polled.size(); i++)
+			serviceTunnel(*polled.at(i), descriptors.at(i + 1).events, descriptors.at(i + 1).revents, buffer, BUFFER_SIZE);
+		
+		for (auto iterator = tunnels_.begin(); iterator != tunnels_.end();) {
+			if (iterator->closed_) {
+				closeTunnel(*iterator);
+				iterator = tunnels_.erase(iterator);
+			} else {
+				++iterator;
+			}
+		}
+	}
+}
+
+void SSHBastion::serviceTunnel(Tunnel& tunnel, short requested, short returned, char* buffer, size_t buffer_size) {
+	// Local socket -> channel
+	if ((requested & POLLIN) && (returned & (POLLIN | POLLHUP | POLLERR))) {
+		ssize_t received = recv(tunnel.socket_, buffer, buffer_size, MSG_DONTWAIT);
+		
+		if (received > 0)
+			tunnel.to_channel_.append(buffer, received);
+		else if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+			tunnel.closed_ = true;
+	}
+	
+	if (!tunnel.to_channel_.empty()) {
+		size_t window = ssh_channel_window_size(tunnel.channel_);
+		size_t amount = min(window, tunnel.to_channel_.length());
+		
+		if (amount > 0) {
+			int wrote = ssh_channel_write(tunnel.channel_, tunnel.to_channel_.c_str(), amount);
+			
+			if (wrote == SSH_ERROR)
+				tunnel.closed_ = true;
+			else if (wrote > 0)
+				tunnel.to_channel_.erase(0, wrote);
+		}
+	}
+	
+	// Channel -> local socket, data the callback had to leave behind is pulled once we caught up
+	if (tunnel.backlogged_ && tunnel.to_socket_.empty()) {
+		int read = ssh_channel_read_nonblocking(tunnel.channel_, buffer, buffer_size, 0);
+		
+		if (read > 0)
+			tunnel.to_socket_.append(buffer, read);
+		else if (read == SSH_ERROR)
+			tunnel.closed_ = true;
+		
+		if (read < static_cast<int>(buffer_size))
+			tunnel.backlogged_ = false;
+	}
+	
+	// Either the socket was writable or the data arrived after we polled
+	if (!tunnel.to_socket_.empty() && ((returned & POLLOUT) || !(requested & POLLOUT))) {
+		ssize_t sent = send(tunnel.socket_, tunnel.to_socket_.c_str(), tunnel.to_socket_.length(), MSG_DONTWAIT | MSG_NOSIGNAL);
+		
+		if (sent > 0)
+			tunnel.to_socket_.erase(0, sent);
+		else if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+			tunnel.closed_ = true;
+	}
+	
+	if (tunnel.remote_eof_ && !tunnel.backlogged_ && tunnel.to_socket_.empty())
+		tunnel.closed_ = true;
+}
@@ -4,20 +4,36 @@
 
 #include <algorithm>
 #include <iostream>
+#include <fstream>
 #include <thread>
+#include <deque>
+#include <condition_variable>
+#include <atomic>
+#include <climits>
+
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
 
 #define ERROR(...)	do { fprintf(stderr, "Error: "); fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); exit(1); } while(0)
 
 using namespace std;
 
+static size_t getResidentBytes();
+
 SSHMaster::SSHMaster() :
-	settings_(SETTING_MAX, false) {
+	pool_size_(0), peak_sessions_(0), connects_(0), evictions_(0), next_bastion_(0), settings_(SETTING_MAX, false) {
 	ssh_threads_set_callbacks(ssh_threads_get_pthread());
 	ssh_init();
+	
+	baseline_resident_bytes_ = getResidentBytes();
 }
 
 SSHMaster::~SSHMaster() {
 	for_each(connections_.begin(), connections_.end(), [] (SSH& session) { session.disconnect(); });
+	
+	// Tunnels must outlive the sessions running over them
+	for_each(bastions_.begin(), bastions_.end(), [] (SSHBastion* bastion) { delete bastion; });
 }
 
 void SSHMaster::setSetting(int setting, bool value) {
@@ -28,45 +44,120 @@ bool SSHMaster::getSetting(int setting) {
 	return settings_.at(setting);
 }
 
-bool SSHMaster::connect(const string& ip, const string& pass) {
-	{
-		lock_guard<mutex> guard(threaded_connections_mutex_);
+bool SSHMaster::setBastion(const string& ip, const string& user, const string& pass, size_t sessions) {
+	if (!connections_.empty() || !hosts_.empty()) {
+		cout << "Warning: set the bastion before connecting to any hosts\n";
 		
-		if (find(connections_.begin(), connections_.end(), ip) != connections_.end()) {
-			cout << ip << " is already connected!\n";
+		return false;
+	}
+	
+	for (size_t i = 0; i < sessions; i++) {
+		SSHBastion* bastion = new SSHBastion(ip, user, pass);
+		
+		if (!bastion->connect()) {
+			delete bastion;
+			
+			// Don't route anything through a partially set up bastion
+			for_each(bastions_.begin(), bastions_.end(), [] (SSHBastion* connected) { delete connected; });
+			bastions_.clear();
 			
 			return false;
 		}
+		
+		bastions_.push_back(bastion);
+	}
+	
+	return true;
+}
+
+SSHBastion* SSHMaster::pickBastion() {
+	if (bastions_.empty())
+		return nullptr;
+		
+	lock_guard<mutex> guard(threaded_connections_mutex_);
+	
+	// Least loaded bastion session, starting the scan from a rotating index to spread ties
+	size_t start = next_bastion_++;
+	SSHBastion* best = nullptr;
+	size_t best_count = 0;
+	
+	for (size_t i = 0; i < bastions_.size(); i++) {
+		SSHBastion* bastion = bastions_.at((start + i) % bastions_.size());
+		
+		// A lost session has no tunnels left, it would always look least loaded
+		if (!bastion->isAlive())
+			continue;
+			
+		size_t count = bastion->getTunnelCount();
+		
+		if (best == nullptr || count < best_count) {
+			best = bastion;
+			best_count = count;
+		}
+	}
+	
+	// Hosts behind the bastion can't be reached directly, hand out a dead one so connecting fails
+	if (best == nullptr) {
+		cout << "Error: no bastion session is alive\n";
+		
+		return bastions_.front();
 	}
 	
-	SSH session(ip, pass);
+	return best;
+}
+
+bool SSHMaster::setPoolSize(size_t max_sessions) {
+	lock_guard<mutex> guard(threaded_connections_mutex_);
 	
-	if (session.connect()) {
-		lock_guard<mutex> guard(threaded_connections_mutex_);
-		connections_.push_back(session);
+	if (!connections_.empty() || !hosts_.empty()) {
+		cout << "Warning: set the pool size before connecting to any hosts\n";
 		
-		return true;
-	} else {
 		return false;
 	}
+	
+	pool_size_ = max_sessions;
+	return true;
+}
+
+// Aggregate upload rate over all sessions, 0 lifts the limit
+void SSHMaster::setBandwidthLimit(size_t bytes_per_second, bool prioritize_commands) {
+	scheduler_.setPrioritized(prioritize_commands);
+	scheduler_.setRate(bytes_per_second);
+}
+
+bool SSHMaster::connect(const string& ip, const string& pass) {
+	return connect(ip, "", pass);
 }
 
 bool SSHMaster::connect(const string& ip, const string& user, const string& pass) {
 	{
 		lock_guard<mutex> guard(threaded_connections_mutex_);
 		
-		if (find(connections_.begin(), connections_.end(), ip) != connections_.end()) {
+		if (sessions_.count(ip) > 0 || hosts_.count(ip) > 0) {
 			cout << ip << " is already connected!\n";
 			
 			return false;
 		}
+		
+		// Pooled hosts are only registered here, they're connected on first use
+		if (pool_size_ > 0) {
+			hosts_[ip] = { user, pass };
+			
+			return true;
+		}
 	}
 	
 	SSH session(ip, user, pass);
+	session.setBastion(pickBastion());
+	session.setScheduler(&scheduler_);
 	
 	if (session.connect()) {
 		lock_guard<mutex> guard(threaded_connections_mutex_);
-		connections_.push_back(session);
+		connections_.push_front(move(session));
+		sessions_[ip] = connections_.begin();
+		
+		connects_++;
+		peak_sessions_ = max(peak_sessions_, connections_.size());
 		
 		return true;
 	} else {
@@ -75,23 +166,243 @@ bool SSHMaster::connect(const string& ip, const string& user, const string& pass
 }
 
 SSH& SSHMaster::getSession(const string& ip, bool threading) {
+	// Not pinned, the pool is free to evict it again once we return
+	if (pool_size_ > 0) {
+		SSH& session = acquirePooledSession(ip);
+		releaseSession(ip);
+		
+		return session;
+	}
+	
+
 	if (threading)
 		threaded_connections_mutex_.lock();
 		
-	auto iterator = find(connections_.begin(), connections_.end(), ip);
+	auto iterator = sessions_.find(ip);
 	
-	if (iterator == connections_.end())
+	if (iterator == sessions_.end())
 		ERROR("could not find session");
 		
 	if (threading)
 		threaded_connections_mutex_.unlock();
 		
-	return *iterator;
+	return *iterator->second;
+}
+
+SessionLease SSHMaster::acquireSession(const string& ip) {
+	if (pool_size_ > 0)
+		return SessionLease(*this, ip, acquirePooledSession(ip));
+		
+	return SessionLease(*this, ip, getSession(ip, true));
+}
+
+SSH& SSHMaster::acquirePooledSession(const string& ip) {
+	unique_lock<mutex> lock(threaded_connections_mutex_);
+	auto host = hosts_.find(ip);
+	
+	if (host == hosts_.end())
+		ERROR("could not find session");
+		
+	in_use_[ip]++;
+	
+	// Someone else might be connecting or evicting this host right now
+	pool_changed_.wait(lock, [this, &ip] { return busy_.count(ip) == 0; });
+	
+	auto iterator = sessions_.find(ip);
+	
+	if (iterator == sessions_.end()) {
+		connections_.emplace_front(ip, host->second.first, host->second.second);
+		iterator = sessions_.insert({ ip, connections_.begin() }).first;
+	}
+	
+	SSH& session = *iterator->second;
+	auto open = open_positions_.find(ip);
+	
+	if (open != open_positions_.end()) {
+		// Most recently used first
+		open_.splice(open_.begin(), open_, open->second);
+		
+		return session;
+	}
+	
+	// A failed connection is retried, unless someone else is already holding on to it
+	if (in_use_.at(ip) > 1)
+		return session;
+		
+	// Make room by evicting the least recently used idle session, or wait until one is idle
+	string evicted;
+	
+	while (open_.size() >= pool_size_ && !evictIdleSession(evicted))
+		pool_changed_.wait(lock);
+		
+	SSH* victim = evicted.empty() ? nullptr : &*sessions_.at(evicted);
+	
+	busy_.insert(ip);
+	open_.push_front(ip);
+	open_positions_[ip] = open_.begin();
+	
+	// Disconnecting and connecting are slow, don't hold up the rest of the pool meanwhile
+	lock.unlock();
+	
+	if (victim != nullptr)
+		victim->disconnect();
+		
+	session.setBastion(pickBastion());
+	session.setScheduler(&scheduler_);
+	bool connected = session.connect();
+	
+	// Eviction took the helper down with the session, bring it back for whoever used it before
+	if (connected && !session.getHelperPath().empty() && !session.startHelper(session.getHelperPath()))
+		cout << "Warning: could not restart helper on " << ip << endl;
+		
+	lock.lock();
+	busy_.erase(ip);
+	
+	if (victim != nullptr)
+		busy_.erase(evicted);
+		
+	if (connected) {
+		connects_++;
+		peak_sessions_ = max(peak_sessions_, open_.size());
+	} else {
+		// Don't let a failed host take up room in the pool
+		open_.erase(open_positions_.at(ip));
+		open_positions_.erase(ip);
+	}
+	
+	pool_changed_.notify_all();
+	
+	return session;
+}
+
+bool SSHMaster::evictIdleSession(string& evicted) {
+	for (auto iterator = open_.end(); iterator != open_.begin(); ) {
+		--iterator;
+		
+		if (in_use_.count(*iterator) > 0 || busy_.count(*iterator) > 0)
+			continue;
+			
+		// The session stays in connections_ so references to it don't dangle, it's just disconnected
+		evicted = *iterator;
+		busy_.insert(evicted);
+		open_positions_.erase(evicted);
+		open_.erase(iterator);
+		evictions_++;
+		
+		return true;
+	}
+	
+	return false;
+}
+
+void SSHMaster::releaseSession(const string& ip) {
+	if (pool_size_ == 0)
+		return;
+		
+	lock_guard<mutex> guard(threaded_connections_mutex_);
+	auto count = in_use_.find(ip);
+	
+	if (count == in_use_.end())
+		return;
+		
+	// Released sessions stay open, they're idle like any other until evicted and failed ones are retried next use
+	if (--count->second == 0)
+		in_use_.erase(count);
+		
+	pool_changed_.notify_all();
+}
+
+SessionLease::SessionLease(SSHMaster& master, const string& ip, SSH& session) :
+	master_(&master), ip_(ip), session_(&session) {
+}
+
+SessionLease::SessionLease(SessionLease&& other) noexcept :
+	master_(other.master_), ip_(move(other.ip_)), session_(other.session_) {
+	other.master_ = nullptr;
+	other.session_ = nullptr;
+}
+
+SessionLease::~SessionLease() {
+	if (master_ != nullptr)
+		master_->releaseSession(ip_);
+}
+
+SSH& SessionLease::operator*() const {
+	return *session_;
+}
+
+SSH* SessionLease::operator->() const {
+	return session_;
+}
+
+static size_t getResidentBytes() {
+	ifstream statm("/proc/self/statm");
+	size_t total_pages = 0, resident_pages = 0;
+	
+	if (!(statm >> total_pages >> resident_pages))
+		return 0;
+		
+	return resident_pages * sysconf(_SC_PAGESIZE);
+}
+
+static size_t getOpenDescriptors() {
+	DIR* directory = opendir("/proc/self/fd");
+	size_t descriptors = 0;
+	
+	if (directory == NULL)
+		return 0;
+		
+	while (readdir(directory) != NULL)
+		descriptors++;
+		
+	closedir(directory);
+	
+	// Skip ".", ".." and the descriptor used for reading the directory
+	return descriptors > 3 ? descriptors - 3 : 0;
+}
+
+PoolStatistics SSHMaster::getPoolStatistics() {
+	PoolStatistics statistics;
+	lock_guard<mutex> guard(threaded_connections_mutex_);
+	
+	statistics.hosts_ = pool_size_ > 0 ? hosts_.size() : sessions_.size();
+	statistics.open_sessions_ = count_if(connections_.begin(), connections_.end(), [] (const SSH& session) { return session.isConnected(); });
+	statistics.peak_sessions_ = peak_sessions_;
+	statistics.connects_ = connects_;
+	statistics.evictions_ = evictions_;
+	statistics.open_descriptors_ = getOpenDescriptors();
+	
+	// libssh can't tell us what a session costs, this only spreads the process growth over them
+	size_t resident = getResidentBytes();
+	statistics.process_growth_bytes_ = resident > baseline_resident_bytes_ ? resident - baseline_resident_bytes_ : 0;
+	statistics.process_growth_per_session_ = statistics.open_sessions_ > 0 ? statistics.process_growth_bytes_ / statistics.open_sessions_ : 0;
+	
+	return statistics;
+}
+
+// Without a pool every host gets its own thread, with one only pool_size_ hosts can be served at a
+// time so that many workers take hosts in turn instead of thousands of threads waiting on the pool
+void SSHMaster::runThreaded(size_t count, const function<void(size_t)>& work) {
+	size_t workers = pool_size_ > 0 ? min(count, pool_size_) : count;
+	atomic<size_t> next(0);
+	thread* threads = new thread[workers];
+	
+	for (size_t i = 0; i < workers; i++)
+		threads[i] = thread([&work, &next, count] {
+			for (size_t id = next++; id < count; id = next++)
+				work(id);
+		});
+		
+	for (size_t i = 0; i < workers; i++)
+		threads[i].join();
+		
+	delete[] threads;
 }
 
 static void transferLocalThreaded(SSHMaster& connections, const string& ip, const string& from, const string& to) {
-	auto& session = connections.getSession(ip, true);
-	bool result = session.transferLocal(from, to, connections.getSetting(SETTING_USE_ACTUAL_FILENAME) ? to : "");
+	auto lease = connections.acquireSession(ip);
+	auto& session = *lease;
+	bool result = session.transferLocal(from, to, connections.getSetting(SETTING_USE_ACTUAL_FILENAME) ? to : "", connections.getSetting(SETTING_RESUMABLE_TRANSFERS), connections.getSetting(SETTING_VERIFY_TRANSFERS));
 	
 	if (result)
 		return;
@@ -105,16 +416,7 @@ bool SSHMaster::transferLocal(const vector<string>& ips, const vector<string>& f
 		
 	if (threading) {
 		threaded_connections_result_ = true;
-		
-		thread* threads = new thread[ips.size()];
-		
-		for (size_t i = 0; i < ips.size(); i++)
-			threads[i] = thread(transferLocalThreaded, ref(*this), ref(ips.at(i)), ref(from.at(i)), ref(to.at(i)));
-			
-		for (size_t i = 0; i < ips.size(); i++)
-			threads[i].join();
-			
-		delete[] threads;
+		runThreaded(ips.size(), [&] (size_t i) { transferLocalThreaded(*this, ips.at(i), from.at(i), to.at(i)); });
 		
 		return threaded_connections_result_;
 	} else {
@@ -136,8 +438,9 @@ bool SSHMaster::transferLocal(const vector<string>& ips, const vector<string>& f
 }
 
 static void transferRemoteThreaded(SSHMaster& connections, const string& ip, const string& from, const string& to, bool overwrite) {
-	auto& session = connections.getSession(ip, true);
-	bool result = session.transferRemote(from, to, overwrite);
+	auto lease = connections.acquireSession(ip);
+	auto& session = *lease;
+	bool result = session.transferRemote(from, to, overwrite, connections.getSetting(SETTING_RESUMABLE_TRANSFERS), connections.getSetting(SETTING_VERIFY_TRANSFERS));
 	
 	if (result)
 		return;
@@ -150,16 +453,7 @@ bool SSHMaster::transferRemote(const vector<string>& ips, const vector<string>&
 		return false;
 		
 	threaded_connections_result_ = true;
-	
-	thread* threads = new thread[ips.size()];
-	
-	for (size_t i = 0; i < ips.size(); i++)
-		threads[i] = thread(transferRemoteThreaded, ref(*this), ref(ips.at(i)), ref(from.at(i)), ref(to.at(i)), overwrite);
-		
-	for (size_t i = 0; i < ips.size(); i++)
-		threads[i].join();
-		
-	delete[] threads;
+	runThreaded(ips.size(), [&] (size_t i) { transferRemoteThreaded(*this, ips.at(i), from.at(i), to.at(i), overwrite); });
 	
 	return threaded_connections_result_;	
 }
@@ -192,29 +486,24 @@ bool SSHMaster::connect(const vector<string>& ips, const string& pass) {
 		return false;
 		
 	threaded_connections_result_ = true;
-		
-	thread* threads = new thread[ips.size()];
-		
-	for (size_t i = 0; i < ips.size(); i++) {
-		threads[i] = thread(connectThreaded, ref(*this), ref(ips.at(i)), ref(pass));
-	}
-	
-	for (size_t i = 0; i < ips.size(); i++) {
-		threads[i].join();
-	}
-	
-	delete[] threads;
+	runThreaded(ips.size(), [&] (size_t i) { connectThreaded(*this, ips.at(i), pass); });
 	
 	return threaded_connections_result_;
 }
 
 void SSHMaster::setConnectResult(size_t id, bool status) {
+	// Neighbouring results share a word in vector<bool>
+	lock_guard<mutex> guard(threaded_connections_mutex_);
 	threaded_online_result_.at(id) = status;
 }
 
-static void connectThreadedResult(SSHMaster& connections, const string& ip, const string& pass, size_t id) {
+static void connectThreadedResult(SSHMaster& connections, const string& ip, const string& pass, size_t id, bool pooled) {
 	bool result = connections.connect(ip, pass);
 	
+	// A pooled connect only registers the host, open a session to find out whether it's online
+	if (result && pooled)
+		result = connections.acquireSession(ip)->isConnected();
+		
 	if (result)
 		return;
 		
@@ -226,17 +515,7 @@ vector<bool> SSHMaster::connectResult(const vector<string>& ips, const string& p
 		return vector<bool>();
 		
 	threaded_online_result_ = vector<bool>(ips.size(), true);
-	thread* threads = new thread[ips.size()];
-	
-	for (size_t i = 0; i < ips.size(); i++) {
-		threads[i] = thread(connectThreadedResult, ref(*this), ref(ips.at(i)), ref(pass), i);
-	}
-	
-	for (size_t i = 0; i < ips.size(); i++) {
-		threads[i].join();
-	}
-	
-	delete[] threads;
+	runThreaded(ips.size(), [&] (size_t i) { connectThreadedResult(*this, ips.at(i), pass, i, pool_size_ > 0); });
 	
 	return threaded_online_result_;
 }
@@ -246,45 +525,177 @@ bool SSHMaster::connect(const vector<string>& ips, const vector<string>& users,
 		return false;
 		
 	threaded_connections_result_ = true;
+	runThreaded(ips.size(), [&] (size_t i) { connectThreadedUser(*this, ips.at(i), users.at(i), passwords.at(i)); });
+	
+	return threaded_connections_result_;	
+}
+
+static void commandThreaded(SSHMaster& connections, const string& ip, const string& command, vector<string>& output) {
+	auto lease = connections.acquireSession(ip);
+	auto& session = *lease;
+	session.clearOutput();
+	
+	bool result = session.command(command, connections.getSetting(SETTING_ENABLE_SSH_OUTPUT), connections.getSetting(SETTING_ENABLE_SSH_OUTPUT_VECTOR_STYLE), connections.getSetting(SETTING_USE_PERSISTENT_SHELL));
+	
+	output = session.getOutput();
+	if (result)
+		return;
 		
-	thread* threads = new thread[ips.size()];
+	connections.setThreadedConnectionStatus(false);	
+}
+
+vector<pair<string, vector<string>>> SSHMaster::command(const vector<string>& ips, const vector<string>& commands) {
+	if (ips.empty())
+		return vector<pair<string, vector<string>>>();
+		
+	vector<pair<string, vector<string>>> outputs;
+	for_each(ips.begin(), ips.end(), [&outputs] (const string& ip) { outputs.push_back({ ip, vector<string>() }); });
+	
+	threaded_connections_result_ = true;
+	runThreaded(ips.size(), [&] (size_t i) { commandThreaded(*this, ips.at(i), commands.at(i), outputs.at(i).second); });
+	
+	if (!threaded_connections_result_)
+		return vector<pair<string, vector<string>>>();
 		
-	for (size_t i = 0; i < ips.size(); i++) {
-		threads[i] = thread(connectThreadedUser, ref(*this), ref(ips.at(i)), ref(users.at(i)), ref(passwords.at(i)));
+	return outputs;
+}
+
+static const size_t BROADCAST_CHUNK_SIZE = 65536;
+static const size_t BROADCAST_MAX_CHUNKS = 16;
+
+// Hands every chunk read from the local source to all consumers, the producer blocks while the
+// slowest consumer is BROADCAST_MAX_CHUNKS behind so memory stays bounded no matter how slow a host is
+class StreamBroadcast {
+public:
+	StreamBroadcast(size_t consumers) :
+		progress_(consumers, 0), base_(0), active_(consumers), done_(false) {}
+		
+	bool push(const shared_ptr<const string>& chunk) {
+		unique_lock<mutex> lock(mutex_);
+		space_.wait(lock, [this] { return chunks_.size() < BROADCAST_MAX_CHUNKS || active_ == 0; });
+		
+		if (active_ == 0)
+			return false;
+			
+		chunks_.push_back(chunk);
+		available_.notify_all();
+		
+		return true;
 	}
 	
-	for (size_t i = 0; i < ips.size(); i++) {
-		threads[i].join();
+	void finish() {
+		lock_guard<mutex> guard(mutex_);
+		done_ = true;
+		available_.notify_all();
 	}
 	
-	delete[] threads;
+	bool next(size_t consumer, shared_ptr<const string>& chunk) {
+		unique_lock<mutex> lock(mutex_);
+		size_t index = progress_.at(consumer);
+		available_.wait(lock, [this, index] { return index < base_ + chunks_.size() || done_; });
+		
+		if (index >= base_ + chunks_.size())
+			return false;
+			
+		chunk = chunks_.at(index - base_);
+		progress_.at(consumer)++;
+		trim();
+		
+		return true;
+	}
 	
-	return threaded_connections_result_;	
-}
+	void leave(size_t consumer) {
+		lock_guard<mutex> guard(mutex_);
+		progress_.at(consumer) = SIZE_MAX;
+		active_--;
+		trim();
+	}
+	
+private:
+	void trim() {
+		size_t slowest = *min_element(progress_.begin(), progress_.end());
+		
+		while (!chunks_.empty() && base_ < slowest) {
+			chunks_.pop_front();
+			base_++;
+		}
+		
+		space_.notify_all();
+	}
+	
+	mutex mutex_;
+	condition_variable available_;
+	condition_variable space_;
+	
+	deque<shared_ptr<const string>> chunks_;
+	vector<size_t> progress_;
+	size_t base_;
+	size_t active_;
+	bool done_;
+};
 
-static void commandThreaded(SSHMaster& connections, const string& ip, const string& command) {
-	auto& session = connections.getSession(ip, true);
-	bool result = session.command(command, connections.getSetting(SETTING_ENABLE_SSH_OUTPUT), connections.getSetting(SETTING_ENABLE_SSH_OUTPUT_VECTOR_STYLE));
+static void commandInputThreaded(SSHMaster& connections, const string& ip, const string& command, StreamBroadcast& broadcast, size_t id, vector<string>& output) {
+	auto lease = connections.acquireSession(ip);
+	auto& session = *lease;
+	session.clearOutput();
+	
+	bool result = session.commandInput(command, [&broadcast, id] (shared_ptr<const string>& chunk) { return broadcast.next(id, chunk); },
+		connections.getSetting(SETTING_ENABLE_SSH_OUTPUT), connections.getSetting(SETTING_ENABLE_SSH_OUTPUT_VECTOR_STYLE));
+		
+	broadcast.leave(id);
 	
+	output = session.getOutput();
 	if (result)
 		return;
 		
-	connections.setThreadedConnectionStatus(false);	
+	connections.setThreadedConnectionStatus(false);
 }
 
-vector<pair<string, vector<string>>> SSHMaster::command(const vector<string>& ips, const vector<string>& commands) {
+vector<pair<string, vector<string>>> SSHMaster::commandInput(const vector<string>& ips, const string& command, const function<ssize_t(char*, size_t)>& generator) {
 	if (ips.empty())
 		return vector<pair<string, vector<string>>>();
 		
-	// Clean current outputs
-	for_each(ips.begin(), ips.end(), [this] (const string& ip) { getSession(ip, false).clearOutput(); });	
+	// The broadcast only buffers BROADCAST_MAX_CHUNKS ahead of the slowest host, so every host must
+	// hold its session until the stream is through, hosts waiting for a pool slot would stall it
+	if (pool_size_ > 0 && ips.size() > pool_size_) {
+		cout << "Warning: can't stream input to more hosts (" << ips.size() << ") than the pool size (" << pool_size_ << ")\n";
+		
+		return vector<pair<string, vector<string>>>();
+	}
+	
+	vector<pair<string, vector<string>>> outputs;
+	for_each(ips.begin(), ips.end(), [&outputs] (const string& ip) { outputs.push_back({ ip, vector<string>() }); });
 	
 	threaded_connections_result_ = true;
+	StreamBroadcast broadcast(ips.size());
 	thread* threads = new thread[ips.size()];
-			
+	
 	for (size_t i = 0; i < ips.size(); i++)
-		threads[i] = thread(commandThreaded, ref(*this), ref(ips.at(i)), ref(commands.at(i)));
+		threads[i] = thread(commandInputThreaded, ref(*this), ref(ips.at(i)), ref(command), ref(broadcast), i, ref(outputs.at(i).second));
+		
+	// Each chunk is read once and shared by all hosts
+	while (true) {
+		shared_ptr<string> chunk = make_shared<string>(BROADCAST_CHUNK_SIZE, '\0');
+		ssize_t read_amount = generator(&chunk->at(0), chunk->length());
 		
+		if (read_amount < 0) {
+			cout << "Warning: could not read input stream for remote commands\n";
+			
+			setThreadedConnectionStatus(false);
+			break;
+		}
+		
+		if (read_amount == 0)
+			break;
+			
+		chunk->resize(read_amount);
+		
+		if (!broadcast.push(chunk))
+			break;
+	}
+	
+	broadcast.finish();
+	
 	for (size_t i = 0; i < ips.size(); i++)
 		threads[i].join();
 		
@@ -293,9 +704,86 @@ vector<pair<string, vector<string>>> SSHMaster::command(const vector<string>& ip
 	if (!threaded_connections_result_)
 		return vector<pair<string, vector<string>>>();
 		
-	// Collect all outputs
-	vector<pair<string, vector<string>>> outputs;
-	for_each(ips.begin(), ips.end(), [this, &outputs] (const string& ip) { outputs.push_back({ ip, getSession(ip, false).getOutput() }); });
-	
 	return outputs;
-}
\ No newline at end of file
+}
+
+vector<pair<string, vector<string>>> SSHMaster::commandInput(const vector<string>& ips, const string& command, int fd) {
+	return commandInput(ips, command, [fd] (char* buffer, size_t size) -> ssize_t {
+		while (true) {
+			ssize_t read_amount = read(fd, buffer, size);
+			
+			if (read_amount < 0 && errno == EINTR)
+				continue;
+				
+			return read_amount;
+		}
+	});
+}
+
+vector<pair<string, vector<string>>> SSHMaster::commandInput(const vector<string>& ips, const string& command, const string& filename) {
+	ifstream file(filename, ios::binary);
+	
+	if (!file.is_open()) {
+		cout << "Warning: could not open " << filename << " as input for remote commands\n";
+		
+		return vector<pair<string, vector<string>>>();
+	}
+	
+	return commandInput(ips, command, [&file] (char* buffer, size_t size) -> ssize_t {
+		file.read(buffer, size);
+		
+		if (file.bad())
+			return -1;
+			
+		return file.gcount();
+	});
+}
+
+
+static void deployHelperThreaded(SSHMaster& connections, const string& ip, const string& local_helper, const string& remote_directory) {
+	auto lease = connections.acquireSession(ip);
+	auto& session = *lease;
+	bool result = session.deployHelper(local_helper, remote_directory);
+	
+	if (result)
+		return;
+		
+	connections.setThreadedConnectionStatus(false);
+}
+
+bool SSHMaster::deployHelper(const vector<string>& ips, const string& local_helper, const string& remote_directory) {
+	if (ips.empty())
+		return false;
+		
+	threaded_connections_result_ = true;
+	runThreaded(ips.size(), [&] (size_t i) { deployHelperThreaded(*this, ips.at(i), local_helper, remote_directory); });
+	
+	return threaded_connections_result_;
+}
+
+static void statThreaded(SSHMaster& connections, const string& ip, const vector<string>& paths, vector<HelperStat>& results) {
+	auto lease = connections.acquireSession(ip);
+	auto& session = *lease;
+	bool result = session.helperStat(paths, results);
+	
+	if (result)
+		return;
+		
+	connections.setThreadedConnectionStatus(false);
+}
+
+vector<pair<string, vector<HelperStat>>> SSHMaster::stat(const vector<string>& ips, const vector<string>& paths) {
+	if (ips.empty())
+		return vector<pair<string, vector<HelperStat>>>();
+		
+	vector<pair<string, vector<HelperStat>>> results;
+	for_each(ips.begin(), ips.end(), [&results] (const string& ip) { results.push_back({ ip, vector<HelperStat>() }); });
+	
+	threaded_connections_result_ = true;
+	runThreaded(ips.size(), [&] (size_t i) { statThreaded(*this, ips.at(i), paths, results.at(i).second); });
+	
+	if (!threaded_connections_result_)
+		return vector<pair<string, vector<HelperStat>>>();
+		
+	return results;
+}